@@ -0,0 +1,44 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+// Minimal micro benchmark harness. Every benchmark prints one JSON object per line, so results can be collected
+// and compared across releases and machines.
+namespace bench {
+
+template <typename T>
+inline void do_not_optimize(T const& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// run f in batches until min_time is reached and report the time per call
+template <typename F>
+void run(const std::string& name, F f, double min_time = .2) {
+    using clock = std::chrono::steady_clock;
+    std::uint64_t iterations = 0;
+    std::uint64_t batch = 1;
+    double elapsed = 0;
+    // warm up
+    for (int i = 0; i < 1000; i++) {
+        f();
+    }
+    auto start = clock::now();
+    while (elapsed < min_time) {
+        for (std::uint64_t i = 0; i < batch; i++) {
+            f();
+        }
+        iterations += batch;
+        batch *= 2;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    }
+    std::cout << "{\"name\":\"" << name << "\",\"iterations\":" << iterations
+              << ",\"ns_per_op\":" << elapsed * 1e9 / iterations << "}" << std::endl;
+}
+
+}  // namespace bench
+
+#endif  // BENCH_H_
@@ -0,0 +1,611 @@
+// Micro benchmarks for the powerbase and race logic hot paths. Build with the sclx_bench target and run it on the
+// target machine, every line of the output is a JSON object with the benchmark name and the time per operation.
+//
+//   sclx_bench [recording [sounds]]
+//
+// Without arguments synthetic powerbase packets are used. A recording is a file of raw powerbase packets as written
+// by sclx_bridge, benchmarks that use it get a "/recorded" suffix. The sound benchmarks load the race sounds from
+// webui/sounds of the source tree the binary was built in, or from the given directory.
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+//#define _WITH_PUT_TIME
+#define _WITH_SHORT_LOG
+#include <tasks/logging.h>
+
+#include <tasks/exec.h>
+
+#include <json/json.h>
+
+#include "bench.h"
+#include "../crc.h"
+#include "../sclx_cmd.h"
+#include "../sclx_consts.h"
+#include "../sclx_ghost.h"
+#include "../sclx_in.h"
+#include "../sclx_json.h"
+#include "../sclx_lanes.h"
+#include "../sclx_schedule.h"
+#include "../sclx_sound.h"
+#include "../sclx_task.h"
+
+#include "../websocket/server_ws.hpp"
+
+using packets_t = std::vector<sclx_in::packet_t>;
+
+// power of two, so the packet index wraps with a mask
+constexpr std::size_t NUM_PACKETS = 1024;
+
+// access to the private update functions of the race engine
+class sclx_task_bench {
+  public:
+    sclx_task_bench(sclx_task& task) : m_task(task) {}
+
+    void set_packets(const sclx_in::packet_t& cur, const sclx_in::packet_t& last) {
+        m_task.m_in[m_task.m_in_cur].packet() = cur;
+        m_task.m_in[m_task.m_in_last].packet() = last;
+    }
+
+    void training() { m_task.set_game_state(sclx_task::game_state_t::TRAINING); }
+
+    void update_handsets() { m_task.update_handsets(); }
+    void update_game() { m_task.update_game(); }
+    void post_game_update() { m_task.post_game_update(false, m_task.m_game.game_time); }
+
+    // update_game hands post_game_update to the exec worker, wait until it is done before calling it from here
+    void wait_for_exec() {
+        while (m_task.m_stats.exec_queue > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+  private:
+    sclx_task& m_task;
+};
+
+namespace {
+
+inline void set_crc(sclx_in::packet_t& p) {
+    p.crc = crc8(&p.status, sizeof(p) - 1);
+}
+
+// synthetic powerbase input: most packets move the throttle of a few lanes, some toggle brake or lane change, the
+// game timer runs and every now and then a car crosses the line
+packets_t make_packets() {
+    std::mt19937 rnd(42);
+    packets_t packets(NUM_PACKETS);
+    std::uint8_t handset[sclx::LANES] = {};
+    std::uint32_t game_time_sf = 0;
+    for (auto& p : packets) {
+        std::memset(&p, 0xff, sizeof(p));
+        p.status = (rnd() % 8 == 0 ? rnd() : 0x7e) & 0x7f;
+        for (int i = 0; i < sclx::LANES; i++) {
+            if (rnd() % 3 == 0) {
+                handset[i] = (handset[i] & ~sclx::POWER) | (rnd() & sclx::POWER);
+            }
+            if (rnd() % 16 == 0) {
+                handset[i] ^= sclx::BRAKE;
+            }
+            if (rnd() % 32 == 0) {
+                handset[i] ^= sclx::LANE_CHANGE;
+            }
+            // the powerbase sends inverted handset bytes
+            p.handset[i] = ~handset[i];
+        }
+        game_time_sf += 1000;
+        p.game_time_sf = game_time_sf;
+        p.carid_sf = rnd() % 64 == 0 ? 1 + rnd() % sclx::LANES : sclx::CARID_INVALID;
+        set_crc(p);
+    }
+    return packets;
+}
+
+// raw packets captured by sclx_bridge. The recording holds the read chunks as they came, so it may start in the
+// middle of a frame or miss bytes. A frame counts if its CRC matches, otherwise we skip a byte and look again. A CRC
+// matches by chance every 256 bytes, so getting back in sync takes two valid frames in a row.
+packets_t load_packets(const char* path) {
+    std::ifstream file(path, std::ios::binary);
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    const std::size_t frame = sizeof(sclx_in::packet_t);
+    auto valid = [&](std::size_t pos) {
+        return pos + frame <= data.size() && data[pos + frame - 1] == crc8(&data[pos], frame - 1);
+    };
+    packets_t packets;
+    bool synced = false;
+    std::size_t skipped = 0;
+    std::size_t pos = 0;
+    while (pos + frame <= data.size()) {
+        if (valid(pos) && (synced || valid(pos + frame))) {
+            sclx_in::packet_t p;
+            std::memcpy(&p, &data[pos], frame);
+            packets.push_back(p);
+            pos += frame;
+            synced = true;
+        } else {
+            synced = false;
+            skipped++;
+            pos++;
+        }
+    }
+    if (skipped > 0) {
+        std::cerr << path << ": skipped " << skipped << " bytes out of sync" << std::endl;
+    }
+    // wrap with a mask as well
+    std::size_t size = 1;
+    while (size * 2 <= packets.size()) {
+        size *= 2;
+    }
+    packets.resize(packets.empty() ? 0 : size);
+    return packets;
+}
+
+// the per lane compare of update_handsets before the bit parallel kernel
+sclx_lanes::changes_t handsets_reference(const sclx_in::packet_t& cur_packet, const sclx_in::packet_t& last_packet) {
+    sclx_lanes::changes_t c = {0, 0, 0, 0};
+    for (int i = 0; i < sclx::LANES; i++) {
+        std::uint8_t cur = ~cur_packet.handset[i];
+        std::uint8_t last = ~last_packet.handset[i];
+        if (cur != last) {
+            if ((sclx::BRAKE & cur) != (sclx::BRAKE & last)) {
+                c.brake |= 1 << i;
+            }
+            if ((sclx::LANE_CHANGE & cur) != (sclx::LANE_CHANGE & last)) {
+                c.lane_change |= 1 << i;
+            }
+            if ((sclx::POWER & cur) != (sclx::POWER & last)) {
+                c.power |= 1 << i;
+            }
+        }
+    }
+    c.any = c.brake | c.lane_change | c.power;
+    return c;
+}
+
+sclx_lanes::changes_t handsets_lanes(const sclx_in::packet_t& cur_packet, const sclx_in::packet_t& last_packet) {
+    return sclx_lanes::changes(sclx_lanes::load(cur_packet.handset), sclx_lanes::load(last_packet.handset));
+}
+
+// the unrolled update_leds before the bit parallel kernel
+std::uint8_t leds_reference(std::uint8_t status, std::uint8_t& connected_mask) {
+    std::uint8_t leds = 0;
+    std::uint8_t connected = 0;
+    if (sclx::HANDSET_1 & status) {
+        leds |= sclx::LED_1;
+        connected |= 1;
+    }
+    if (sclx::HANDSET_2 & status) {
+        leds |= sclx::LED_2;
+        connected |= 1 << 1;
+    }
+    if (sclx::HANDSET_3 & status) {
+        leds |= sclx::LED_3;
+        connected |= 1 << 2;
+    }
+    if (sclx::HANDSET_4 & status) {
+        leds |= sclx::LED_4;
+        connected |= 1 << 3;
+    }
+    if (sclx::HANDSET_5 & status) {
+        leds |= sclx::LED_5;
+        connected |= 1 << 4;
+    }
+    if (sclx::HANDSET_6 & status) {
+        leds |= sclx::LED_6;
+        connected |= 1 << 5;
+    }
+    connected_mask = connected;
+    return leds;
+}
+
+std::uint8_t leds_lanes(std::uint8_t status, std::uint8_t& connected_mask) {
+    connected_mask = sclx_lanes::connected(status);
+    return sclx_lanes::leds(status);
+}
+
+bool verify_lanes(const packets_t& packets) {
+    for (std::size_t i = 1; i < packets.size(); i++) {
+        auto a = handsets_reference(packets[i], packets[i - 1]);
+        auto b = handsets_lanes(packets[i], packets[i - 1]);
+        if (a.brake != b.brake || a.lane_change != b.lane_change || a.power != b.power || a.any != b.any) {
+            std::cerr << "handset kernel mismatch at packet " << i << std::endl;
+            return false;
+        }
+        std::uint8_t ca, cb;
+        if (leds_reference(packets[i].status, ca) != leds_lanes(packets[i].status, cb) || ca != cb) {
+            std::cerr << "led kernel mismatch at packet " << i << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void bench_protocol(const packets_t& packets, const std::string& suffix) {
+    std::size_t mask = packets.size() - 1;
+    std::size_t n = 0;
+    bench::run("crc8" + suffix, [&] {
+        n = (n + 1) & mask;
+        bench::do_not_optimize(crc8(&packets[n].status, sizeof(sclx_in::packet_t) - 1));
+    });
+    sclx_in in;
+    bench::run("sclx_in::valid" + suffix, [&] {
+        n = (n + 1) & mask;
+        in.packet() = packets[n];
+        bench::do_not_optimize(in.valid());
+    });
+}
+
+void bench_lanes(const packets_t& packets, const std::string& suffix) {
+    if (!verify_lanes(packets)) {
+        std::exit(1);
+    }
+    std::size_t mask = packets.size() - 1;
+    std::size_t n = 0;
+    bench::run("handset_changes/reference" + suffix, [&] {
+        n = (n + 1) & mask;
+        bench::do_not_optimize(handsets_reference(packets[n], packets[(n - 1) & mask]).any);
+    });
+    bench::run("handset_changes/lanes" + suffix, [&] {
+        n = (n + 1) & mask;
+        bench::do_not_optimize(handsets_lanes(packets[n], packets[(n - 1) & mask]).any);
+    });
+    bench::run("led_status/reference" + suffix, [&] {
+        n = (n + 1) & mask;
+        std::uint8_t connected;
+        bench::do_not_optimize(leds_reference(packets[n].status, connected));
+        bench::do_not_optimize(connected);
+    });
+    bench::run("led_status/lanes" + suffix, [&] {
+        n = (n + 1) & mask;
+        std::uint8_t connected;
+        bench::do_not_optimize(leds_lanes(packets[n].status, connected));
+        bench::do_not_optimize(connected);
+    });
+}
+
+void bench_task(sclx_task& task, const packets_t& packets, const std::string& suffix) {
+    sclx_task_bench tb(task);
+    tb.training();
+    std::size_t mask = packets.size() - 1;
+    std::size_t n = 0;
+    bench::run("sclx_task::update_handsets" + suffix, [&] {
+        n = (n + 1) & mask;
+        tb.set_packets(packets[n], packets[(n - 1) & mask]);
+        tb.update_handsets();
+    });
+    // two lanes driven from phones, one new virtual handset state per cycle
+    std::uint8_t power = 0;
+    bench::run("sclx_task::update_handsets/virtual" + suffix, [&] {
+        n = (n + 1) & mask;
+        power = (power + 1) & sclx::POWER;
+        task.set_virtual_handset(n & 1, power, false, false);
+        tb.set_packets(packets[n], packets[(n - 1) & mask]);
+        tb.update_handsets();
+    });
+    task.release_virtual_handset(0);
+    task.release_virtual_handset(1);
+    tb.update_handsets();
+    // a ghost car replaying a lap of 3000 cycles with a new throttle value every 100 cycles
+    sclx_ghost::lap_t lap;
+    for (std::uint8_t i = 0; i < 30; i++) {
+        lap.runs.push_back({100, static_cast<std::uint8_t>(i * 2)});
+        lap.cycles += 100;
+    }
+    task.start_ghost(2, lap);
+    bench::run("sclx_task::update_handsets/ghost" + suffix, [&] {
+        n = (n + 1) & mask;
+        tb.set_packets(packets[n], packets[(n - 1) & mask]);
+        tb.update_handsets();
+    });
+    task.stop_ghost();
+    tb.update_handsets();
+    const char frame[sclx_cmd::handset_t::SIZE] = {'H', 2, 40, 0, 1, 2, 3, 4};
+    bench::run("sclx_cmd::parse/handset", [&] {
+        sclx_cmd::handset_t cmd;
+        bench::do_not_optimize(sclx_cmd::parse(frame, frame + sizeof(frame), cmd));
+        bench::do_not_optimize(cmd.stamp);
+    });
+    bench::run("sclx_task::update_game" + suffix, [&] {
+        n = (n + 1) & mask;
+        tb.set_packets(packets[n], packets[(n - 1) & mask]);
+        tb.update_game();
+    });
+    tb.wait_for_exec();
+    bench::run("sclx_task::post_game_update" + suffix, [&] { tb.post_game_update(); });
+}
+
+// the message building and serialization of write_json_to_ws
+std::string serialize(Json::Value& root) {
+    Json::FastWriter writer;
+    std::stringstream out;
+    out << writer.write(root);
+    return out.str();
+}
+
+Json::Value lap_count_json(std::uint8_t carid, std::uint8_t lap, std::uint64_t lap_time, bool record) {
+    Json::Value root;
+    root["type"] = "lap_count";
+    root["id"] = carid;
+    root["lap"] = lap;
+    root["lap_time"] = lap_time;
+    root["record"] = record;
+    return root;
+}
+
+Json::Value game_update_json(std::uint64_t game_time, const std::vector<std::uint8_t>& positions) {
+    Json::Value root;
+    root["type"] = "game_update";
+    root["time"] = game_time;
+    Json::Value pos_arr(Json::arrayValue);
+    for (auto p : positions) {
+        pos_arr.append(p);
+    }
+    root["positions"] = pos_arr;
+    return root;
+}
+
+// the fixed schema encoder has to match the jsoncpp output byte by byte
+bool verify_json() {
+    std::string buf;
+    std::vector<std::uint8_t> positions;
+    for (std::uint8_t carid = 0; carid < sclx::LANES; carid++) {
+        positions.push_back(carid);
+        for (std::uint64_t time : {UINT64_C(0), UINT64_C(7345123), UINT64_C(18446744073709551615)}) {
+            Json::Value lap = lap_count_json(carid, carid * 51, time, carid & 1);
+            Json::Value update = game_update_json(time, positions);
+            if (serialize(lap) != sclx_json::lap_count(buf, carid, carid * 51, time, carid & 1) ||
+                serialize(update) != sclx_json::game_update(buf, time, positions)) {
+                std::cerr << "sclx_json output differs from Json::FastWriter: " << buf;
+                return false;
+            }
+        }
+    }
+    // strings get the escaping of jsoncpp, UTF-8 and broken sequences included
+    for (const char* state : {"RACE", "tab\t\"quote\"\\", "Z\xc3\xbcrich", "\xf0\x9f\x8f\x81", "\xc3", "\xed\xa0\x80"}) {
+        Json::Value root;
+        root["type"] = "game_state";
+        root["state"] = state;
+        if (serialize(root) != sclx_json::game_state(buf, state)) {
+            std::cerr << "sclx_json output differs from Json::FastWriter: " << buf;
+            return false;
+        }
+    }
+    return true;
+}
+
+void bench_json() {
+    if (!verify_json()) {
+        std::exit(1);
+    }
+    const std::vector<std::uint8_t> positions = {3, 1, 0, 5, 2, 4};
+    bench::run("write_json_to_ws/lap_count", [] {
+        Json::Value root = lap_count_json(3, 12, 7345123, true);
+        bench::do_not_optimize(serialize(root));
+    });
+    bench::run("write_json_to_ws/game_update", [&] {
+        Json::Value root = game_update_json(123456789, positions);
+        bench::do_not_optimize(serialize(root));
+    });
+    std::string buf;
+    bench::run("sclx_json/lap_count", [&] {
+        bench::do_not_optimize(sclx_json::lap_count(buf, 3, 12, 7345123, true).size());
+    });
+    bench::run("sclx_json/game_update", [&] {
+        bench::do_not_optimize(sclx_json::game_update(buf, 123456789, positions).size());
+    });
+}
+
+// a settings update as sent by the web ui
+const char* const settings_msg =
+    "{\"type\":\"settings\",\"drivers\":["
+    "{\"id\":0,\"name\":\"Unbekannt\",\"power\":100,\"curve\":\"linear\",\"image\":\"images/driver.png\"},"
+    "{\"id\":1,\"name\":\"Anna\",\"power\":80,\"curve\":\"s_curve\",\"image\":\"images/driver.png\"},"
+    "{\"id\":2,\"name\":\"Ben\",\"power\":65,\"curve\":\"exponential\",\"image\":\"images/driver.png\"}],"
+    "\"controllers\":["
+    "{\"driver\":\"1\",\"connected\":true,\"image\":\"images/driver_green.png\",\"id\":0},"
+    "{\"driver\":2,\"connected\":true,\"image\":\"images/driver_red.png\",\"id\":1},"
+    "{\"driver\":0,\"connected\":false,\"image\":\"images/driver_orange.png\",\"id\":2}],"
+    "\"digital_car_mode\":true}";
+
+void bench_schedule() {
+    sclx_out_schedule schedule;
+    sclx_out::packet_t packet;
+    bench::run("sclx_out_schedule::compose/idle", [&] {
+        bench::do_not_optimize(schedule.compose(packet, sclx::LED_1 | sclx::LED_2));
+        bench::do_not_optimize(packet.led_status);
+    });
+    // a LED animation step and a car mode switch queued from another thread now and then
+    auto blink = sclx_out_schedule::sequence(
+        1, sclx_out_schedule::NO_CHANNEL,
+        {sclx_out_schedule::leds(sclx::LED_GREEN | sclx::LED_RED, 0, 0), sclx_out_schedule::leds(0, sclx::LED_RED, 1),
+         sclx_out_schedule::event(0, 0)});
+    auto car_mode = sclx_out_schedule::sequence(0, sclx_out_schedule::CAR_MODE, {sclx_out_schedule::aux(0x7f, 0)});
+    std::size_t n = 0;
+    bench::run("sclx_out_schedule::compose/sequences", [&] {
+        n++;
+        if ((n & 3) == 0) {
+            schedule.push(blink);
+        }
+        if ((n & 15) == 0) {
+            schedule.push(car_mode);
+        }
+        bench::do_not_optimize(schedule.compose(packet, sclx::LED_1 | sclx::LED_2));
+        bench::do_not_optimize(packet.led_status);
+    });
+}
+
+void bench_cmd() {
+    std::string msg(settings_msg);
+    bench::run("handle_message/settings/json_reader", [&] {
+        std::stringstream data(msg);
+        Json::Reader reader;
+        Json::Value root;
+        reader.parse(data, root, false);
+        bench::do_not_optimize(root["type"].asString() == "settings" && root["drivers"].size() == 3);
+    });
+    bench::run("handle_message/settings/sclx_cmd", [&] {
+        sclx_json_reader::slice_t type;
+        sclx_cmd::settings_t cmd;
+        sclx_cmd::parse_type(msg.data(), msg.data() + msg.size(), type);
+        sclx_json_reader in(msg.data(), msg.data() + msg.size());
+        bench::do_not_optimize(type.equals("settings") && sclx_cmd::parse(in, cmd) && cmd.drivers.size() == 3);
+    });
+}
+
+void bench_ws() {
+    using server_t = SimpleWeb::SocketServerBase<SimpleWeb::WS>;
+    for (std::size_t size : {64, 1024, 65536}) {
+        auto payload = std::make_shared<const std::string>(size, 'x');
+        bench::run("SocketServerBase::send/frame_copy_" + std::to_string(size), [&] {
+            // header and payload copied into one buffer, like send did before
+            auto write_buffer = std::make_shared<boost::asio::streambuf>();
+            std::ostream response(write_buffer.get());
+            unsigned char header[10];
+            response.write(reinterpret_cast<char*>(header), server_t::make_header(header, payload->size()));
+            response << *payload;
+            bench::do_not_optimize(write_buffer->size());
+        });
+        bench::run("SocketServerBase::send/frame_gather_" + std::to_string(size), [&] {
+            unsigned char header[10];
+            std::vector<boost::asio::const_buffer> buffers;
+            buffers.emplace_back(header, server_t::make_header(header, payload->size()));
+            buffers.emplace_back(payload->data(), payload->size());
+            bench::do_not_optimize(boost::asio::buffer_size(buffers));
+        });
+    }
+    const unsigned char mask[4] = {0x12, 0x34, 0x56, 0x78};
+    for (std::size_t size : {64, 1024, 65536}) {
+        // odd sizes cover the tail handling as well
+        std::vector<unsigned char> in(size + 3);
+        std::vector<unsigned char> out(in.size());
+        std::mt19937 rng(size);
+        for (auto& b : in) {
+            b = rng();
+        }
+        server_t::unmask(in.data(), out.data(), in.size(), mask);
+        for (std::size_t i = 0; i < in.size(); i++) {
+            if (out[i] != (in[i] ^ mask[i % 4])) {
+                std::cerr << "unmask differs from the bytewise reference at " << i << std::endl;
+                std::exit(1);
+            }
+        }
+        bench::run("SocketServerBase::unmask/bytewise_" + std::to_string(size), [&] {
+            for (std::size_t i = 0; i < in.size(); i++) {
+                out[i] = in[i] ^ mask[i % 4];
+            }
+            bench::do_not_optimize(out[0]);
+        });
+        bench::run("SocketServerBase::unmask/bulk_" + std::to_string(size), [&] {
+            server_t::unmask(in.data(), out.data(), in.size(), mask);
+            bench::do_not_optimize(out[0]);
+        });
+    }
+    // the deflate settings of sclx, every game update is compressed on each connection that negotiated it
+    SimpleWeb::Deflate::Options options;
+    options.window_bits = 13;
+    options.mem_level = 7;
+    std::string update;
+    sclx_json::game_update(update, 123456789, {3, 1, 0, 5, 2, 4});
+    for (bool context_takeover : {true, false}) {
+        SimpleWeb::Deflate::Params params;
+        params.server_no_context_takeover = !context_takeover;
+        SimpleWeb::Deflate::Compressor compressor(options, params);
+        std::string out;
+        bench::run(std::string("SocketServerBase::send/deflate_game_update") + (context_takeover ? "" : "_no_context"),
+                   [&] {
+                       compressor.compress(update.data(), update.size(), out);
+                       bench::do_not_optimize(out.size());
+                   });
+    }
+}
+
+void bench_sound(const std::string& dir) {
+    sclx_sound sound;
+    try {
+        bench::run("sclx_sound::load/finish.wav", [&] { sound.load("finish", dir + "/finish.wav"); }, .5);
+        sound.load_dir(dir, "");
+    } catch (tasks::tasks_exception& e) {
+        std::cerr << "skipping the sound benchmarks: " << e.what() << std::endl;
+        return;
+    }
+    // the voices end during the run, so the 17s of the ceremony are timed in one go with the shorter sounds ending
+    // on the way
+    std::int16_t out[sclx_sound::PERIOD * sclx_sound::CHANNELS];
+    sound.play("ceremony.wav");
+    sound.play("lap.wav");
+    sound.play("finish.wav");
+    sound.play("start2.wav");
+    const std::uint64_t periods = 3000;
+    auto start = std::chrono::steady_clock::now();
+    for (std::uint64_t i = 0; i < periods; i++) {
+        sound.mix(out, sclx_sound::PERIOD);
+        bench::do_not_optimize(out[0]);
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "{\"name\":\"sclx_sound::mix/race_sounds\",\"iterations\":" << periods
+              << ",\"ns_per_op\":" << elapsed * 1e9 / periods << "}" << std::endl;
+}
+
+// the binary lives in the build directory below the source tree, don't depend on where it is started from
+std::string sounds_dir() {
+    char exe[4096];
+    ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (len <= 0) {
+        return "../webui/sounds";
+    }
+    std::string path(exe, len);
+    return path.substr(0, path.rfind('/')) + "/../webui/sounds";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    try {
+        // the race engine hands events to tasks::exec
+        tasks::dispatcher::init_workers(1);
+        auto disp = tasks::dispatcher::instance();
+        disp->start();
+
+        std::vector<std::pair<packets_t, std::string>> inputs;
+        inputs.push_back({make_packets(), "/synthetic"});
+        if (argc > 1) {
+            auto recorded = load_packets(argv[1]);
+            if (recorded.size() < 2) {
+                std::cerr << "no packets in " << argv[1] << std::endl;
+                return 1;
+            }
+            inputs.push_back({recorded, "/recorded"});
+        }
+
+        // the pty stands in for the powerbase, no frames are exchanged
+        sclx_task task("pty");
+        for (auto& input : inputs) {
+            bench_protocol(input.first, input.second);
+            bench_lanes(input.first, input.second);
+            bench_task(task, input.first, input.second);
+        }
+        bench_schedule();
+        bench_json();
+        bench_cmd();
+        bench_ws();
+        bench_sound(argc > 2 ? argv[2] : sounds_dir());
+
+        disp->terminate();
+        disp->join();
+    } catch (tasks::tasks_exception& e) {
+        terr("error: " << e.what() << std::endl);
+        return 1;
+    }
+    return 0;
+}
@@ -1,6 +1,9 @@
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <thread>
@@ -16,27 +19,54 @@
 
 #include <json/json.h>
 
+#include "sclx_cmd.h"
 #include "sclx_cycle_task.h"
+#include "sclx_ghost.h"
+#include "sclx_json.h"
+#include "sclx_lanes.h"
+#include "sclx_log.h"
+#include "sclx_sound.h"
+#include "sclx_subscriptions.h"
 #include "sclx_task.h"
+#include "sclx_trace.h"
+#include "sclx_webui.h"
 
 #include "websocket/server_ws.hpp"
 
 sclx_task* sclx;
 int laps = 3;
 std::atomic<bool> starting;
-SimpleWeb::SocketServer<SimpleWeb::WS> sclx_ws(8383, 2);
+// one io thread per core
+SimpleWeb::SocketServer<SimpleWeb::WS> sclx_ws(8383, 0);
 std::mutex mtx_ws;
+// guards driver_map, controllers, digital_car_mode and laps, the websocket threads and the sclx task share them
+std::mutex mtx_settings;
 std::string settings_path("settings.json");
+std::unique_ptr<sclx_webui> webui;
+sclx_sound sound;
+std::atomic<std::uint64_t> settings_saves(0);
 
 using connection_ptr_t = std::shared_ptr<SimpleWeb::SocketServerBase<SimpleWeb::WS>::Connection>;
 using message_ptr_t = std::shared_ptr<SimpleWeb::SocketServerBase<SimpleWeb::WS>::Message>;
 
+using subscriptions_t = sclx_subscriptions<connection_ptr_t>;
+subscriptions_t subscriptions;
+
+// the clients driving a lane with a virtual handset
+std::mutex mtx_handsets;
+connection_ptr_t handset_owners[sclx::LANES];
+
+// the fastest lap since the start, the ghost car replays it
+std::mutex mtx_ghost;
+std::shared_ptr<const sclx_ghost::lap_t> ghost_lap;
+
 struct driver_t {
     int id;
     std::string name;
     std::uint8_t power;
+    sclx_task::throttle_curve_t curve;
     std::string image;
-    driver_t() : id(0), power(100) {}
+    driver_t() : id(0), power(100), curve(sclx_task::throttle_curve_t::LINEAR) {}
 };
 
 struct controller_t {
@@ -46,13 +76,46 @@ struct controller_t {
     controller_t() : driver(0), connected(false) {}
 };
 
-std::string controller_images[] = {"images/driver_green.png", "images/driver_red.png",    "images/driver_orange.png",
+const std::string controller_images[] = {"images/driver_green.png", "images/driver_red.png",    "images/driver_orange.png",
                                    "images/driver_white.png", "images/driver_yellow.png", "images/driver_blue.png"};
 
 std::map<int, driver_t> driver_map;
-controller_t controllers[6];
+controller_t controllers[sclx::LANES];
+static_assert(sizeof(controller_images) / sizeof(controller_images[0]) >= sclx::LANES, "a controller image per lane");
 bool digital_car_mode = true;
 
+std::string throttle_curve_to_string(sclx_task::throttle_curve_t curve) {
+    switch (curve) {
+        case sclx_task::throttle_curve_t::LINEAR:
+            return "linear";
+        case sclx_task::throttle_curve_t::EXPONENTIAL:
+            return "exponential";
+        case sclx_task::throttle_curve_t::S_CURVE:
+            return "s_curve";
+        case sclx_task::throttle_curve_t::DEADBAND:
+            return "deadband";
+    }
+    return "";
+}
+
+sclx_task::throttle_curve_t throttle_curve_from_string(const std::string& curve) {
+    if (curve == "exponential") {
+        return sclx_task::throttle_curve_t::EXPONENTIAL;
+    } else if (curve == "s_curve") {
+        return sclx_task::throttle_curve_t::S_CURVE;
+    } else if (curve == "deadband") {
+        return sclx_task::throttle_curve_t::DEADBAND;
+    }
+    return sclx_task::throttle_curve_t::LINEAR;
+}
+
+// mtx_settings has to be locked
+void apply_driver(int ctrl_id) {
+    driver_t& driver = driver_map[controllers[ctrl_id].driver];
+    sclx->set_power_rate(ctrl_id, driver.power);
+    sclx->set_throttle_curve(ctrl_id, driver.curve);
+}
+
 void load_settings() {
     std::ifstream file;
     file.open(settings_path);
@@ -60,12 +123,14 @@ void load_settings() {
         Json::Reader reader;
         Json::Value root;
         if (reader.parse(file, root, false)) {
+            std::lock_guard<std::mutex> lock(mtx_settings);
             Json::Value tmp = root["drivers"];
             for (Json::ArrayIndex i = 0; i < tmp.size(); i++) {
                 driver_t driver;
                 driver.id = tmp[i]["id"].asInt();
                 driver.name = tmp[i]["name"].asString();
                 driver.power = tmp[i]["power"].asInt();
+                driver.curve = throttle_curve_from_string(tmp[i]["curve"].asString());
                 driver.image = tmp[i]["image"].asString();
                 driver_map[driver.id] = driver;
             }
@@ -73,9 +138,13 @@ void load_settings() {
             for (Json::ArrayIndex i = 0; i < tmp.size(); i++) {
                 int id = tmp[i]["id"].asInt();
                 int driverid = tmp[i]["driver"].asInt();
+                if (id < 0 || id >= sclx::LANES) {
+                    // settings of a bigger powerbase
+                    continue;
+                }
                 controllers[id].driver = driverid;
                 controllers[id].image = controller_images[id];
-                sclx->set_power_rate(id, driver_map[driverid].power);
+                apply_driver(id);
             }
             if (root.isMember("laps")) {
                 laps = root["laps"].asInt();
@@ -89,7 +158,9 @@ void load_settings() {
     }
 }
 
+// locks mtx_settings, so the file always holds a consistent state
 void save_settings() {
+    std::lock_guard<std::mutex> lock(mtx_settings);
     Json::Value root;
     root["type"] = "settings";
     for (auto& driver : driver_map) {
@@ -97,10 +168,11 @@ void save_settings() {
         drv["id"] = driver.second.id;
         drv["name"] = driver.second.name;
         drv["power"] = driver.second.power;
+        drv["curve"] = throttle_curve_to_string(driver.second.curve);
         drv["image"] = driver.second.image;
         root["drivers"].append(drv);
     }
-    for (int i = 0; i < 6; i++) {
+    for (int i = 0; i < sclx::LANES; i++) {
         Json::Value ctrl;
         ctrl["id"] = i;
         ctrl["driver"] = controllers[i].driver;
@@ -114,24 +186,275 @@ void save_settings() {
     if (file.good()) {
         Json::StyledStreamWriter writer;
         writer.write(file, root);
+        settings_saves++;
         terr("wrote settings to " << settings_path << std::endl);
     }
 }
 
-void write_json_to_ws(Json::Value& root, connection_ptr_t conn = nullptr) {
+// completion handler for websocket writes, only needed for tracing
+std::function<void(const boost::system::error_code&)> ws_write_done() {
+#ifdef SCLX_TRACE
+    auto start = SCLX_TRACE_NOW();
+    return [start](const boost::system::error_code&) { SCLX_TRACE_SPAN("ws::async_write", start); };
+#else
+    return nullptr;
+#endif
+}
+
+void write_to_ws(std::string msg, connection_ptr_t conn) {
+    SCLX_TRACE_SCOPE("write_to_ws");
+    sclx_ws.send(conn, std::make_shared<const std::string>(std::move(msg)), ws_write_done());
+}
+
+void write_json_to_ws(Json::Value& root, connection_ptr_t conn) {
+    SCLX_TRACE_SCOPE("write_json_to_ws");
     Json::FastWriter writer;
-    std::stringstream out;
-    out << writer.write(root);
-    if (nullptr != conn) {
-        sclx_ws.send(conn, out);
-    } else {
-        std::lock_guard<std::mutex> lock(mtx_ws);
-        for (auto c : sclx_ws.get_connections()) {
-            sclx_ws.send(c, out);
+    write_to_ws(writer.write(root), conn);
+}
+
+// a broadcast, lane is -1 for events that are not about a single lane
+struct ws_event_t {
+    sclx_topic::topic_t topic;
+    int lane;
+    std::string msg;
+};
+
+// the broadcasts of the current event batch
+thread_local std::vector<ws_event_t>* ws_batch = nullptr;
+
+// Send events to their subscribers. A subscriber gets all its events in one frame (a JSON array if there are
+// several), subscribers that get the same events share the payload. The events of a batch are handled in chunks of
+// 64, an event is a bit of the mask that says which events a subscriber gets.
+void send_events(std::vector<ws_event_t>& events) {
+    SCLX_TRACE_SCOPE("send_events");
+    struct receiver_t {
+        subscriptions_t::subscriber_t* sub;
+        std::uint64_t events;
+    };
+    // reused by every batch of the thread
+    thread_local std::vector<receiver_t> receivers;
+    thread_local std::vector<std::shared_ptr<const std::string>> messages;
+    std::int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch())
+                           .count();
+    // the snapshots keep the subscribers alive until everything is sent
+    std::shared_ptr<const subscriptions_t::list_t> lists[sclx_topic::NUM_TOPICS];
+    for (int t = 0; t < sclx_topic::NUM_TOPICS; t++) {
+        lists[t] = subscriptions.subscribers(static_cast<sclx_topic::topic_t>(t));
+    }
+    messages.clear();
+    for (auto& ev : events) {
+        messages.push_back(std::make_shared<const std::string>(std::move(ev.msg)));
+    }
+    for (std::size_t first = 0; first < events.size(); first += 64) {
+        std::size_t count = std::min<std::size_t>(events.size() - first, 64);
+        std::uint64_t topic_events[sclx_topic::NUM_TOPICS] = {};
+        std::uint64_t lane_events[sclx::LANES] = {};
+        std::uint64_t all_lanes = 0;  // events that are not about a single lane
+        for (std::size_t e = 0; e < count; e++) {
+            auto& ev = events[first + e];
+            topic_events[ev.topic] |= UINT64_C(1) << e;
+            (ev.lane >= 0 ? lane_events[ev.lane] : all_lanes) |= UINT64_C(1) << e;
+        }
+
+        receivers.clear();
+        {
+            // the positions rate of a subscriber is checked and advanced by one batch at a time
+            std::lock_guard<std::mutex> lock(mtx_ws);
+            for (int t = 0; t < sclx_topic::NUM_TOPICS; t++) {
+                if (0 == topic_events[t]) {
+                    continue;
+                }
+                for (auto& sub : *lists[t]) {
+                    std::uint64_t mask = all_lanes;
+                    for (std::uint8_t lanes = sub->lanes & ((1 << sclx::LANES) - 1); lanes; lanes &= lanes - 1) {
+                        mask |= lane_events[sclx_lanes::first(lanes)];
+                    }
+                    mask &= topic_events[t];
+                    if (sclx_topic::POSITIONS == t && mask) {
+                        // the rate the subscriber asked for, with some tolerance for the cycle jitter
+                        std::int64_t interval = sub->positions_interval_ms;
+                        if (now < sub->positions_next_ms - interval / 10) {
+                            continue;
+                        }
+                        sub->positions_next_ms = now + interval;
+                        mask &= ~mask + 1;
+                    }
+                    if (mask) {
+                        receivers.push_back({sub.get(), mask});
+                    }
+                }
+            }
+        }
+
+        // one entry per subscriber, then the subscribers with the same events next to each other
+        std::sort(receivers.begin(), receivers.end(),
+                  [](const receiver_t& a, const receiver_t& b) { return a.sub < b.sub; });
+        std::size_t n = 0;
+        for (std::size_t i = 0; i < receivers.size(); i++) {
+            if (n > 0 && receivers[n - 1].sub == receivers[i].sub) {
+                receivers[n - 1].events |= receivers[i].events;
+            } else {
+                receivers[n++] = receivers[i];
+            }
         }
+        receivers.resize(n);
+        std::sort(receivers.begin(), receivers.end(),
+                  [](const receiver_t& a, const receiver_t& b) { return a.events < b.events; });
+
+        std::shared_ptr<const std::string> payload;
+        for (std::size_t i = 0; i < receivers.size(); i++) {
+            std::uint64_t mask = receivers[i].events;
+            if (0 == i || mask != receivers[i - 1].events) {
+                if (0 == (mask & (mask - 1))) {
+                    payload = messages[first + __builtin_ctzll(mask)];
+                } else {
+                    std::string msg;
+                    for (std::uint64_t m = mask; m; m &= m - 1) {
+                        msg += msg.empty() ? '[' : ',';
+                        msg += *messages[first + __builtin_ctzll(m)];
+                    }
+                    msg += "]\n";
+                    payload = std::make_shared<const std::string>(std::move(msg));
+                }
+            }
+            SCLX_TRACE_SCOPE("ws::send");
+            sclx_ws.send(receivers[i].sub->conn, payload, ws_write_done());
+        }
+    }
+    messages.clear();
+}
+
+void publish(sclx_topic::topic_t topic, int lane, std::string msg) {
+    if (nullptr != ws_batch) {
+        ws_batch->push_back({topic, lane, std::move(msg)});
+    } else {
+        std::vector<ws_event_t> events;
+        events.push_back({topic, lane, std::move(msg)});
+        send_events(events);
+    }
+}
+
+void publish_json(sclx_topic::topic_t topic, int lane, Json::Value& root) {
+    Json::FastWriter writer;
+    publish(topic, lane, writer.write(root));
+}
+
+// the events of one powerbase cycle are sent together
+void event_batch(const std::function<void()>& run_events) {
+    std::vector<ws_event_t> batch;
+    struct batch_guard {
+        explicit batch_guard(std::vector<ws_event_t>* b) { ws_batch = b; }
+        ~batch_guard() { ws_batch = nullptr; }
+    };
+    {
+        batch_guard guard(&batch);
+        run_events();
+    }
+    if (!batch.empty()) {
+        send_events(batch);
+    }
+}
+
+// the race engine only does the work for what the clients subscribed to
+void apply_subscriptions() {
+    sclx->set_handset_events(!subscriptions.subscribers(sclx_topic::HANDSETS)->empty());
+    std::uint32_t interval = subscriptions.positions_interval();
+    sclx->set_game_update_interval(UINT64_C(1000) * (interval > 0 ? interval : 1000));
+}
+
+// buffer for a fixed schema event, the event takes its storage over and the next one gets a new buffer
+std::string& event_buffer() {
+    thread_local std::string buf;
+    if (buf.capacity() < 256) {
+        buf.reserve(256);
     }
+    return buf;
+}
+
+// prometheus text format
+template <typename T>
+void write_metric(std::ostream& out, const char* name, const char* type, const char* help, T value) {
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " " << type << "\n";
+    out << name << " " << value << "\n";
 }
 
+void write_metrics(connection_ptr_t, std::ostream& response) {
+    auto& stats = sclx->stats();
+    std::stringstream out;
+    out << std::fixed << std::setprecision(6);
+    write_metric(out, "sclx_powerbase_cycles_total", "counter", "Valid packets received from the powerbase.",
+                 stats.cycles.load());
+    write_metric(out, "sclx_powerbase_cycle_seconds_total", "counter", "Sum of all powerbase cycle times.",
+                 stats.cycle_time_us.load() / 1e6);
+    write_metric(out, "sclx_powerbase_cycle_jitter_seconds", "gauge",
+                 "Smoothed deviation of the powerbase cycle time from its mean.",
+                 stats.cycle_jitter_us.load() / 1e6);
+    write_metric(out, "sclx_powerbase_crc_errors_total", "counter", "Packets from the powerbase with a bad CRC.",
+                 stats.crc_errors.load());
+    write_metric(out, "sclx_powerbase_cycle_resets_total", "counter",
+                 "Serial connection resets after the powerbase stopped responding.", stats.cycle_resets.load());
+    write_metric(out, "sclx_virtual_handset_stale_total", "counter",
+                 "Virtual handsets that sent no input within the timeout and got braked.", stats.virtual_stale.load());
+    write_metric(out, "sclx_schedule_dropped_total", "counter",
+                 "LED sequences and AUX packets the outbound frame scheduler had to drop.",
+                 stats.schedule_dropped.load());
+    write_metric(out, "sclx_exec_queue_depth", "gauge", "Race events waiting for the exec pool.",
+                 stats.exec_queue.load());
+    auto connections = sclx_ws.get_connections();
+    write_metric(out, "sclx_ws_connections", "gauge", "Connected websocket clients.", connections.size());
+    write_metric(out, "sclx_ws_messages_sent_total", "counter", "Websocket frames sent.",
+                 sclx_ws.messages_sent.load());
+    write_metric(out, "sclx_ws_bytes_sent_total", "counter", "Websocket bytes sent.", sclx_ws.bytes_sent.load());
+    write_metric(out, "sclx_ws_deflate_in_bytes_total", "counter", "Websocket payload bytes before compression.",
+                 sclx_ws.deflate_bytes_in.load());
+    write_metric(out, "sclx_ws_deflate_out_bytes_total", "counter", "Websocket payload bytes after compression.",
+                 sclx_ws.deflate_bytes_out.load());
+    write_metric(out, "sclx_ws_evicted_total", "counter", "Websocket clients dropped because they missed a ping.",
+                 sclx_ws.connections_evicted.load());
+    out << "# HELP sclx_ws_send_queue_high_water Maximum number of frames queued for a connection.\n";
+    out << "# TYPE sclx_ws_send_queue_high_water gauge\n";
+    for (auto& c : connections) {
+        out << "sclx_ws_send_queue_high_water{client=\"" << c->remote_endpoint_address.to_string() << ":"
+            << c->remote_endpoint_port << "\"} " << c->send_queue_high_water() << "\n";
+    }
+    out << "# HELP sclx_ws_subscribers Websocket clients subscribed to a topic.\n";
+    out << "# TYPE sclx_ws_subscribers gauge\n";
+    for (int t = 0; t < sclx_topic::NUM_TOPICS; t++) {
+        auto topic = static_cast<sclx_topic::topic_t>(t);
+        out << "sclx_ws_subscribers{topic=\"" << sclx_topic::to_string(topic) << "\"} "
+            << subscriptions.subscribers(topic)->size() << "\n";
+    }
+    write_metric(out, "sclx_sound_played_total", "counter", "Sounds started.", sound.played());
+    write_metric(out, "sclx_sound_dropped_total", "counter", "Sounds not played because the sample or all voices were busy.",
+                 sound.dropped());
+    write_metric(out, "sclx_sound_underruns_total", "counter", "Sound output underruns.", sound.underruns());
+    write_metric(out, "sclx_log_dropped_total", "counter", "Log messages dropped because the log queue was full.",
+                 sclx_log::dropped());
+    write_metric(out, "sclx_settings_saves_total", "counter", "Settings written to disk.", settings_saves.load());
+
+    std::string body = out.str();
+    response << "HTTP/1.1 200 OK\r\n";
+    response << "Content-Type: text/plain; version=0.0.4\r\n";
+    response << "Content-Length: " << body.size() << "\r\n";
+    response << "Connection: close\r\n\r\n";
+    response << body;
+}
+
+#ifdef SCLX_TRACE
+void write_trace(connection_ptr_t, std::ostream& response) {
+    std::stringstream out;
+    sclx_trace::dump(out);
+    std::string body = out.str();
+    response << "HTTP/1.1 200 OK\r\n";
+    response << "Content-Type: application/json\r\n";
+    response << "Content-Length: " << body.size() << "\r\n";
+    response << "Connection: close\r\n\r\n";
+    response << body;
+}
+#endif
+
 void button_press(std::uint8_t btn) {
     switch (btn) {
         case sclx::BTN_START:
@@ -140,25 +463,30 @@ void button_press(std::uint8_t btn) {
                 if (sclx->game_state() == sclx_task::game_state_t::TRAINING) {
                     // select all connected controllers for a new race
                     std::vector<std::uint8_t> carids;
-                    for (std::uint8_t i = 0; i < 6; i++) {
-                        if (controllers[i].connected) {
-                            carids.push_back(i);
+                    int race_laps;
+                    {
+                        std::lock_guard<std::mutex> lock(mtx_settings);
+                        for (std::uint8_t i = 0; i < sclx::LANES; i++) {
+                            if (controllers[i].connected || sclx->virtual_handset(i) || sclx->ghost_lane() == i) {
+                                carids.push_back(i);
+                            }
                         }
+                        race_laps = laps;
                     }
                     // init the race, false starts are now possible
-                    terr("new game - " << laps << " laps, " << carids.size() << " cars" << std::endl);
-                    sclx->game_init(laps, carids);
+                    terr("new game - " << race_laps << " laps, " << carids.size() << " cars" << std::endl);
+                    sclx->game_init(race_laps, carids);
 
                     // send countdown messages to the web app to show the race lights
                     Json::Value root;
                     root["type"] = "countdown";
                     root["number"] = 4;
-                    write_json_to_ws(root);
+                    publish_json(sclx_topic::RACE, -1, root);
                     sleep(11);
                     bool error = false;
                     for (int i = 3; i > 1; i--) {
                         root["number"] = i;
-                        write_json_to_ws(root);
+                        publish_json(sclx_topic::RACE, -1, root);
                         sleep(2);
                         if (sclx->game_state() != sclx_task::game_state_t::COUNTDOWN) {
                             // false start
@@ -170,14 +498,14 @@ void button_press(std::uint8_t btn) {
                     // start the race
                     if (!error) {
                         root["number"] = 1;
-                        write_json_to_ws(root);
+                        publish_json(sclx_topic::RACE, -1, root);
                         sclx->game_start();
                         sleep(2);
                     }
 
                     // hide the race lights in the web app
                     root["number"] = 0;
-                    write_json_to_ws(root);
+                    publish_json(sclx_topic::RACE, -1, root);
                 } else {
                     sclx->training();
                 }
@@ -185,24 +513,30 @@ void button_press(std::uint8_t btn) {
             }
             break;
         case sclx::BTN_UP: {
-            laps++;
-            // update the UI
             Json::Value root;
             root["type"] = "laps_update";
-            root["laps"] = laps;
-            write_json_to_ws(root);
+            {
+                std::lock_guard<std::mutex> lock(mtx_settings);
+                root["laps"] = ++laps;
+            }
+            // update the UI
+            publish_json(sclx_topic::RACE, -1, root);
             // save it
             save_settings();
             break;
         }
         case sclx::BTN_DOWN: {
-            if (laps > 1) {
-                laps--;
+            Json::Value root;
+            root["type"] = "laps_update";
+            {
+                std::lock_guard<std::mutex> lock(mtx_settings);
+                if (laps > 1) {
+                    root["laps"] = --laps;
+                }
+            }
+            if (root.isMember("laps")) {
                 // update the UI
-                Json::Value root;
-                root["type"] = "laps_update";
-                root["laps"] = laps;
-                write_json_to_ws(root);
+                publish_json(sclx_topic::RACE, -1, root);
                 // save it
                 save_settings();
             }
@@ -212,24 +546,24 @@ void button_press(std::uint8_t btn) {
 }
 
 void lap_count(std::uint8_t carid, std::uint8_t lap, std::uint64_t lap_time, bool record) {
-    Json::Value root;
-    root["type"] = "lap_count";
-    root["id"] = carid;
-    root["lap"] = lap;
-    root["lap_time"] = lap_time;
-    root["record"] = record;
-    write_json_to_ws(root);
+    publish(sclx_topic::RACE, carid, std::move(sclx_json::lap_count(event_buffer(), carid, lap, lap_time, record)));
 }
 
 void false_start(std::uint64_t carid) {
-    Json::Value root;
-    root["type"] = "false_start";
-    root["id"] = carid;
-    write_json_to_ws(root);
+    publish(sclx_topic::RACE, carid, std::move(sclx_json::false_start(event_buffer(), carid)));
+}
+
+void reaction(std::uint8_t carid, std::int64_t reaction_time, bool jump_start) {
+    publish(sclx_topic::RACE, carid, std::move(sclx_json::reaction(event_buffer(), carid, reaction_time, jump_start)));
 }
 
 void game_finished(std::uint64_t game_time, std::vector<std::uint8_t>& positions) {
-    terr("game finished, laps: " << (int)laps << "  game time: " << ((double)game_time) / 1000000 << std::endl);
+    int race_laps;
+    {
+        std::lock_guard<std::mutex> lock(mtx_settings);
+        race_laps = laps;
+    }
+    terr("game finished, laps: " << race_laps << "  game time: " << ((double)game_time) / 1000000 << std::endl);
     int pos = 1;
     for (auto car : positions) {
         terr("(" << pos++ << ") car " << (int)car << std::endl);
@@ -242,19 +576,11 @@ void game_finished(std::uint64_t game_time, std::vector<std::uint8_t>& positions
         pos_arr.append(p);
     }
     root["positions"] = pos_arr;
-    write_json_to_ws(root);
+    publish_json(sclx_topic::RACE, -1, root);
 }
 
 void game_update(std::uint64_t game_time, std::vector<std::uint8_t>& positions) {
-    Json::Value root;
-    root["type"] = "game_update";
-    root["time"] = game_time;
-    Json::Value pos_arr(Json::arrayValue);
-    for (auto p : positions) {
-        pos_arr.append(p);
-    }
-    root["positions"] = pos_arr;
-    write_json_to_ws(root);
+    publish(sclx_topic::POSITIONS, -1, std::move(sclx_json::game_update(event_buffer(), game_time, positions)));
 }
 
 std::string game_state_to_string(sclx_task::game_state_t state) {
@@ -282,73 +608,245 @@ std::string game_state_to_string(sclx_task::game_state_t state) {
 }
 
 void game_state_change(sclx_task::game_state_t state) {
-    Json::Value root;
-    root["type"] = "game_state";
-    root["state"] = game_state_to_string(state);
-    write_json_to_ws(root);
+    publish(sclx_topic::RACE, -1, std::move(sclx_json::game_state(event_buffer(), game_state_to_string(state))));
 }
 
 void controller_change(std::uint8_t id, bool connected) {
-    controllers[id].connected = connected;
-    Json::Value root;
-    root["type"] = "controller_changed";
-    root["id"] = id;
-    root["connected"] = connected;
-    root["image"] = controller_images[id];
-    write_json_to_ws(root);
+    {
+        std::lock_guard<std::mutex> lock(mtx_settings);
+        controllers[id].connected = connected;
+    }
+    publish(sclx_topic::SETTINGS, id,
+            std::move(sclx_json::controller_changed(event_buffer(), id, connected, controller_images[id])));
 }
 
-void handle_message(connection_ptr_t conn, message_ptr_t msg) {
-    std::stringstream data;
-    msg->data >> data.rdbuf();
+void handset_change(std::uint8_t id, std::uint8_t power, bool brake, bool lane_change) {
+    publish(sclx_topic::HANDSETS, id, std::move(sclx_json::handset(event_buffer(), id, power, brake, lane_change)));
+}
 
-    Json::Reader reader;
+// the lane of the ghost car (-1 if it is off) and its lap, mtx_ghost has to be locked
+Json::Value ghost_json(int lane) {
     Json::Value root;
-    if (reader.parse(data, root, false)) {
-        // Json::StyledStreamWriter writer;
-        // writer.write(std::cout, root);
-        if (root.isMember("type")) {
-            if (root["type"].asString() == "settings") {
-                // settings update
-                driver_map.clear();
-                Json::Value tmp = root["drivers"];
-                for (Json::ArrayIndex i = 0; i < tmp.size(); i++) {
-                    driver_t driver;
-                    driver.id = tmp[i]["id"].asInt();
-                    driver.name = tmp[i]["name"].asString();
-                    driver.power = tmp[i]["power"].asInt();
-                    driver.image = tmp[i]["image"].asString();
-                    driver_map[driver.id] = driver;
-                }
-                tmp = root["controllers"];
-                for (Json::ArrayIndex i = 0; i < tmp.size(); i++) {
-                    int id = tmp[i]["id"].asInt();
-                    Json::Value v = tmp[i]["driver"];
-                    if (v.isString()) {
-                        controllers[id].driver = std::stoul(v.asString());
-                    } else {
-                        controllers[id].driver = v.asInt();
-                    }
-                    sclx->set_power_rate(id, driver_map[controllers[id].driver].power);
+    root["type"] = "ghost";
+    root["lane"] = lane;
+    if (ghost_lap) {
+        root["car"] = ghost_lap->carid;
+        root["lap_time"] = static_cast<Json::UInt64>(ghost_lap->lap_time);
+    }
+    return root;
+}
+
+int ghost_lane() {
+    return sclx->ghost_lane() < sclx::LANES ? sclx->ghost_lane() : -1;
+}
+
+void publish_ghost(int lane) {
+    Json::Value root = ghost_json(lane);
+    publish_json(sclx_topic::RACE, -1, root);
+}
+
+void ghost_lap_recorded(std::uint8_t carid, std::shared_ptr<const sclx_ghost::lap_t> lap) {
+    std::lock_guard<std::mutex> lock(mtx_ghost);
+    if (!ghost_lap || lap->lap_time < ghost_lap->lap_time) {
+        terr("new ghost lap by car " << (int)carid << ": " << lap->lap_time / 1000 << "ms, " << lap->cycles
+                                     << " cycles in " << lap->runs.size() << " runs" << std::endl);
+        ghost_lap = lap;
+        publish_ghost(ghost_lane());
+    }
+}
+
+void handle_settings(connection_ptr_t, const sclx_cmd::settings_t& cmd) {
+    std::unique_lock<std::mutex> lock(mtx_settings);
+    driver_map.clear();
+    for (auto& d : cmd.drivers) {
+        driver_t driver;
+        driver.id = d.id;
+        driver.name = d.name;
+        driver.power = d.power;
+        driver.curve = throttle_curve_from_string(d.curve);
+        driver.image = d.image;
+        driver_map[driver.id] = driver;
+    }
+    for (auto& c : cmd.controllers) {
+        controllers[c.id].driver = c.driver;
+        apply_driver(c.id);
+    }
+    digital_car_mode = cmd.digital_car_mode;
+    sclx->set_digital_car_mode(digital_car_mode);
+    lock.unlock();
+    save_settings();
+}
+
+void handle_bind_car(connection_ptr_t, const sclx_cmd::bind_car_t& cmd) {
+    sclx->bind_car(cmd.id);
+}
+
+void handle_latency(connection_ptr_t conn, const sclx_cmd::latency_t& cmd) {
+    // handset to drive packet turnaround per lane in microseconds
+    Json::Value resp;
+    resp["type"] = "latency";
+    for (std::uint8_t i = 0; i < sclx::LANES; i++) {
+        auto& h = sclx->latency(i);
+        Json::Value lane;
+        lane["id"] = i;
+        lane["count"] = static_cast<Json::UInt64>(h.count());
+        lane["mean"] = static_cast<Json::UInt64>(h.mean());
+        lane["p50"] = static_cast<Json::UInt64>(h.percentile(50));
+        lane["p90"] = static_cast<Json::UInt64>(h.percentile(90));
+        lane["p99"] = static_cast<Json::UInt64>(h.percentile(99));
+        lane["p999"] = static_cast<Json::UInt64>(h.percentile(99.9));
+        lane["max"] = static_cast<Json::UInt64>(h.max());
+        // virtual handset frame to drive packet
+        auto& v = sclx->virtual_latency(i);
+        if (v.count() > 0) {
+            Json::Value virt;
+            virt["count"] = static_cast<Json::UInt64>(v.count());
+            virt["mean"] = static_cast<Json::UInt64>(v.mean());
+            virt["p50"] = static_cast<Json::UInt64>(v.percentile(50));
+            virt["p99"] = static_cast<Json::UInt64>(v.percentile(99));
+            virt["max"] = static_cast<Json::UInt64>(v.max());
+            lane["virtual"] = virt;
+        }
+        resp["lanes"].append(lane);
+    }
+    write_json_to_ws(resp, conn);
+    if (cmd.reset) {
+        sclx->reset_latency();
+    }
+}
+
+void handle_play_sound(connection_ptr_t, const sclx_cmd::play_sound_t& cmd) {
+    // every client asks for the same sound, the engine plays it once
+    sound.play(cmd.file);
+}
+
+void handle_ghost(connection_ptr_t, const sclx_cmd::ghost_t& cmd) {
+    std::lock_guard<std::mutex> lock(mtx_ghost);
+    if (cmd.lane < 0) {
+        sclx->stop_ghost();
+    } else if (ghost_lap) {
+        sclx->start_ghost(cmd.lane, *ghost_lap);
+    } else {
+        terr("no ghost lap recorded yet" << std::endl);
+        return;
+    }
+    publish_ghost(cmd.lane);
+}
+
+void handle_subscribe(connection_ptr_t conn, const sclx_cmd::subscribe_t& cmd) {
+    subscriptions.subscribe(conn, cmd.topics, cmd.lanes, cmd.positions_interval);
+    apply_subscriptions();
+}
+
+// parse a command of type C and pass it on to the handler, false if the command is invalid
+template <typename C, void (*handler)(connection_ptr_t, const C&)>
+bool dispatch(connection_ptr_t conn, message_ptr_t msg) {
+    C cmd;
+    sclx_json_reader in(msg->begin(), msg->end());
+    if (!sclx_cmd::parse(in, cmd)) {
+        terr("invalid command: " << std::string(msg->begin(), msg->end()) << std::endl);
+        return false;
+    }
+    handler(conn, cmd);
+    return true;
+}
+
+struct command_t {
+    const char* type;
+    bool (*dispatch)(connection_ptr_t, message_ptr_t);
+};
+
+// tell the client that its command was rejected
+void send_error(connection_ptr_t conn, const char* type, const std::string& message) {
+    Json::Value resp;
+    resp["type"] = "error";
+    resp["command"] = type;
+    resp["message"] = message;
+    write_json_to_ws(resp, conn);
+}
+
+const command_t commands[] = {
+    {"settings", dispatch<sclx_cmd::settings_t, handle_settings>},
+    {"bind_car", dispatch<sclx_cmd::bind_car_t, handle_bind_car>},
+    {"latency", dispatch<sclx_cmd::latency_t, handle_latency>},
+    {"play_sound", dispatch<sclx_cmd::play_sound_t, handle_play_sound>},
+    {"subscribe", dispatch<sclx_cmd::subscribe_t, handle_subscribe>},
+    {"ghost", dispatch<sclx_cmd::ghost_t, handle_ghost>},
+};
+
+// Binary frames carry the state of a virtual handset, a phone sends them at up to the powerbase cycle rate. The
+// first client that sends for a lane drives it until it disconnects.
+void handle_handset(connection_ptr_t conn, message_ptr_t msg) {
+    sclx_cmd::handset_t cmd;
+    if (!sclx_cmd::parse(msg->begin(), msg->end(), cmd)) {
+        terr("invalid handset frame, " << msg->length << " bytes" << std::endl);
+        return;
+    }
+    bool owner;
+    {
+        std::lock_guard<std::mutex> lock(mtx_handsets);
+        if (!handset_owners[cmd.lane]) {
+            handset_owners[cmd.lane] = conn;
+        }
+        owner = handset_owners[cmd.lane] == conn;
+    }
+    if (owner) {
+        sclx->set_virtual_handset(cmd.lane, cmd.power, cmd.flags & sclx_cmd::handset_t::BRAKE,
+                                  cmd.flags & sclx_cmd::handset_t::LANE_CHANGE);
+    }
+    if (cmd.flags & sclx_cmd::handset_t::ACK) {
+        // the client measures the round trip with the stamp
+        auto ack = std::make_shared<std::string>(sclx_cmd::handset_ack_t::SIZE, '\0');
+        bool rejected = !owner || sclx->physical_handset(cmd.lane);
+        sclx_cmd::handset_ack_t::write(&(*ack)[0], cmd.lane, rejected ? sclx_cmd::handset_ack_t::REJECTED : 0,
+                                       cmd.stamp);
+        // fin_rsv_opcode=130: binary
+        sclx_ws.send(conn, std::move(ack), ws_write_done(), 130);
+    }
+}
+
+void release_handsets(connection_ptr_t conn) {
+    std::lock_guard<std::mutex> lock(mtx_handsets);
+    for (std::uint8_t i = 0; i < sclx::LANES; i++) {
+        if (handset_owners[i] == conn) {
+            handset_owners[i].reset();
+            sclx->release_virtual_handset(i);
+        }
+    }
+}
+
+void handle_message(connection_ptr_t conn, message_ptr_t msg) {
+    // a failing command must not take the server down, tasks::tasks_exception is a std::exception as well
+    if ((msg->fin_rsv_opcode & 0x0f) == 2) {
+        try {
+            handle_handset(conn, msg);
+        } catch (std::exception& e) {
+            terr("handset frame failed: " << e.what() << std::endl);
+        }
+        return;
+    }
+    sclx_json_reader::slice_t type;
+    if (!sclx_cmd::parse_type(msg->begin(), msg->end(), type)) {
+        return;
+    }
+    for (auto& cmd : commands) {
+        if (type.equals(cmd.type)) {
+            try {
+                if (!cmd.dispatch(conn, msg)) {
+                    send_error(conn, cmd.type, "invalid command");
                 }
-                digital_car_mode = root["digital_car_mode"].asBool();
-                sclx->set_digital_car_mode(digital_car_mode);
-                save_settings();
-            } else if (root["type"].asString() == "bind_car") {
-                std::uint8_t id = root["id"].asInt();
-                sclx->bind_car(id);
-            } else if (root["type"].asString() == "play_sound") {
-                std::string cmd = "/opt/sclx_c7042/rpi_sound.sh /opt/sclx_c7042/webui/";
-                cmd += root["file"].asString();
-                tasks::exec([cmd] { std::system(cmd.c_str()); });
+            } catch (std::exception& e) {
+                terr(cmd.type << " failed: " << e.what() << std::endl);
+                send_error(conn, cmd.type, e.what());
             }
+            return;
         }
     }
 }
 
 int main(int argc, char** argv) {
     if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <serial device>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <serial device | pty | tcp://host:port> [webui dir]" << std::endl;
         return 1;
     }
 
@@ -356,6 +854,7 @@ int main(int argc, char** argv) {
     auto& ws = sclx_ws.endpoint["^/sclx/?$"];
 
     try {
+        sclx_log::start();
         tasks::dispatcher::init_workers(1);
         auto disp = tasks::dispatcher::instance();
         disp->start();
@@ -367,10 +866,14 @@ int main(int argc, char** argv) {
         sclx->on_button_press(button_press);
         sclx->on_lap_count(lap_count);
         sclx->on_false_start(false_start);
+        sclx->on_reaction(reaction);
         sclx->on_game_finished(game_finished);
         sclx->on_game_update(game_update);
         sclx->on_game_state_change(game_state_change);
         sclx->on_controller_change(controller_change);
+        sclx->on_handset_change(handset_change);
+        sclx->on_ghost_lap(ghost_lap_recorded);
+        sclx->on_event_batch(event_batch);
         disp->add_task(sclx);
         sclx_cycle_task* cycle = new sclx_cycle_task(sclx, 1.);
         disp->add_task(cycle);
@@ -380,6 +883,9 @@ int main(int argc, char** argv) {
         // send the game state on a new connection
         ws.onopen = [](connection_ptr_t conn) {
             terr("new client, sending settings and game state" << std::endl);
+            subscriptions.subscribe(conn, sclx_topic::DEFAULT_TOPICS, sclx_lanes::ALL, 1000);
+            apply_subscriptions();
+            std::unique_lock<std::mutex> lock(mtx_settings);
             Json::Value root;
             root["type"] = "settings";
             for (auto& driver : driver_map) {
@@ -387,10 +893,11 @@ int main(int argc, char** argv) {
                 drv["id"] = driver.second.id;
                 drv["name"] = driver.second.name;
                 drv["power"] = driver.second.power;
+                drv["curve"] = throttle_curve_to_string(driver.second.curve);
                 drv["image"] = driver.second.image;
                 root["drivers"].append(drv);
             }
-            for (int i = 0; i < 6; i++) {
+            for (int i = 0; i < sclx::LANES; i++) {
                 Json::Value ctrl;
                 ctrl["id"] = i;
                 ctrl["driver"] = controllers[i].driver;
@@ -399,18 +906,92 @@ int main(int argc, char** argv) {
                 root["controllers"].append(ctrl);
             }
             root["digital_car_mode"] = digital_car_mode;
+            int current_laps = laps;
+            lock.unlock();
             write_json_to_ws(root, conn);
             root["type"] = "game_state";
             root["state"] = game_state_to_string(sclx->game_state());
             write_json_to_ws(root, conn);
             root["type"] = "laps_update";
-            root["laps"] = laps;
+            root["laps"] = current_laps;
             write_json_to_ws(root, conn);
+            std::lock_guard<std::mutex> ghost_lock(mtx_ghost);
+            Json::Value ghost = ghost_json(ghost_lane());
+            write_json_to_ws(ghost, conn);
         };
         ws.onmessage = handle_message;
+        ws.onclose = [](connection_ptr_t conn, int, const std::string&) {
+            subscriptions.unsubscribe(conn);
+            apply_subscriptions();
+            release_handsets(conn);
+        };
+        ws.onerror = [](connection_ptr_t conn, const boost::system::error_code&) {
+            subscriptions.unsubscribe(conn);
+            apply_subscriptions();
+            release_handsets(conn);
+        };
+        // permessage-deflate for the clients that offer it, a 8k window keeps the compressor at about 96k per
+        // connection and still catches the repeated keys of the events
+        const char* deflate_env = std::getenv("SCLX_WS_DEFLATE");
+        sclx_ws.deflate_options.enabled = nullptr == deflate_env || std::strcmp(deflate_env, "0") != 0;
+        sclx_ws.deflate_options.min_length = 32;
+        sclx_ws.deflate_options.window_bits = 13;
+        sclx_ws.deflate_options.mem_level = 7;
+        // ping every client and drop the ones that do not answer, a phone that went to sleep or left the wifi
+        // would get every broadcast queued for minutes until TCP gives up
+        const char* ping_env = std::getenv("SCLX_WS_PING");
+        const char* pong_env = std::getenv("SCLX_WS_PONG_TIMEOUT");
+        sclx_ws.ping_interval = nullptr != ping_env ? std::atoi(ping_env) : 10;
+        sclx_ws.pong_timeout = nullptr != pong_env ? std::atoi(pong_env) : 10;
+        if (sclx_ws.ping_interval > 0 && sclx_ws.pong_timeout > sclx_ws.ping_interval) {
+            // the next ping is due before the answer, the server would wait for the ping interval anyway
+            terr("SCLX_WS_PONG_TIMEOUT " << sclx_ws.pong_timeout << "s is longer than the ping interval, using "
+                                         << sclx_ws.ping_interval << "s" << std::endl);
+            sclx_ws.pong_timeout = sclx_ws.ping_interval;
+        }
+        // a virtual handset without frames for this long brakes the car
+        const char* virtual_env = std::getenv("SCLX_VIRTUAL_TIMEOUT_MS");
+        if (nullptr != virtual_env) {
+            sclx->set_virtual_handset_timeout(std::atoi(virtual_env) * UINT64_C(1000));
+        }
+        // serve the web ui, the race control works without it
+        std::string webui_dir = argc > 2 ? argv[2] : "../webui";
+        try {
+            webui.reset(new sclx_webui(webui_dir));
+            webui->install(sclx_ws);
+            terr("serving " << webui->assets().size() << " files from " << webui_dir << " ("
+                            << webui->memory() / 1024 << "k in memory)" << std::endl);
+        } catch (tasks::tasks_exception& e) {
+            terr("web ui not available: " << e.what() << std::endl);
+        }
+        // sounds for the play_sound command, the output is picked with SCLX_SOUND
+        const char* sound_env = std::getenv("SCLX_SOUND");
+#ifdef SCLX_ALSA
+        std::string sound_out = nullptr != sound_env ? sound_env : "alsa";
+#else
+        std::string sound_out = nullptr != sound_env ? sound_env : "off";
+#endif
+        if (sound_out != "off") {
+            try {
+                auto sink = sclx_sound::make_sink(sound_out);
+                std::size_t files = sound.load_dir(webui_dir + "/sounds", "sounds/");
+                sound.start(std::move(sink));
+                terr("playing " << files << " sounds on " << sound_out << " (" << sound.memory() / 1024
+                                << "k in memory)" << std::endl);
+            } catch (tasks::tasks_exception& e) {
+                terr("no sound: " << e.what() << std::endl);
+            }
+        }
+        sclx_ws.resource["^/metrics$"] = write_metrics;
+#ifdef SCLX_TRACE
+        sclx_ws.resource["^/trace$"] = write_trace;
+        sclx_trace::install_signal_handler();
+#endif
         tasks::exec([] { sclx_ws.start(); });
 
         disp->join();
+        sound.stop();
+        sclx_log::stop();
     } catch (tasks::tasks_exception& e) {
         terr("error: " << e.what() << std::endl);
     }
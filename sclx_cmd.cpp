@@ -0,0 +1,544 @@
+#include "sclx_cmd.h"
+
+#include <cstddef>
+
+#include "sclx_consts.h"
+
+namespace {
+
+// nesting limit for skipped values
+constexpr int MAX_DEPTH = 32;
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+bool read_hex4(const char*& p, const char* end, std::uint32_t& value) {
+    if (end - p < 4) {
+        return false;
+    }
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+        int v = hex_value(*p++);
+        if (v < 0) {
+            return false;
+        }
+        value = value << 4 | v;
+    }
+    return true;
+}
+
+void append_utf8(std::string& out, std::uint32_t cp) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xc0 | cp >> 6);
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xe0 | cp >> 12);
+        out += static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    } else {
+        out += static_cast<char>(0xf0 | cp >> 18);
+        out += static_cast<char>(0x80 | (cp >> 12 & 0x3f));
+        out += static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    }
+}
+
+bool decode_string(const sclx_json_reader::slice_t& raw, std::string& out) {
+    out.clear();
+    const char* p = raw.data;
+    const char* end = raw.data + raw.size;
+    while (p < end) {
+        const char* run = p;
+        while (p < end && *p != '\\') {
+            p++;
+        }
+        out.append(run, p - run);
+        if (p == end) {
+            break;
+        }
+        // the raw string never ends with a single backslash
+        p++;
+        switch (*p++) {
+            case '"':
+                out += '"';
+                break;
+            case '\\':
+                out += '\\';
+                break;
+            case '/':
+                out += '/';
+                break;
+            case 'b':
+                out += '\b';
+                break;
+            case 'f':
+                out += '\f';
+                break;
+            case 'n':
+                out += '\n';
+                break;
+            case 'r':
+                out += '\r';
+                break;
+            case 't':
+                out += '\t';
+                break;
+            case 'u': {
+                std::uint32_t cp;
+                if (!read_hex4(p, end, cp)) {
+                    return false;
+                }
+                if (cp >= 0xd800 && cp < 0xdc00) {
+                    // surrogate pair
+                    std::uint32_t low;
+                    if (end - p < 6 || p[0] != '\\' || p[1] != 'u') {
+                        return false;
+                    }
+                    p += 2;
+                    if (!read_hex4(p, end, low) || low < 0xdc00 || low > 0xdfff) {
+                        return false;
+                    }
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                } else if (cp >= 0xdc00 && cp <= 0xdfff) {
+                    return false;
+                }
+                append_utf8(out, cp);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+bool sclx_json_reader::read_string(slice_t& value) {
+    if (!expect('"')) {
+        return false;
+    }
+    const char* start = m_pos;
+    while (m_pos < m_end) {
+        char c = *m_pos;
+        if ('"' == c) {
+            value.data = start;
+            value.size = m_pos - start;
+            m_pos++;
+            return true;
+        } else if ('\\' == c) {
+            m_pos += 2;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            return fail();
+        } else {
+            m_pos++;
+        }
+    }
+    return fail();
+}
+
+bool sclx_json_reader::read_string(std::string& value) {
+    if (peek('n')) {
+        value.clear();
+        return read_literal("null");
+    }
+    slice_t raw;
+    if (!read_string(raw)) {
+        return false;
+    }
+    if (!decode_string(raw, value)) {
+        return fail();
+    }
+    return true;
+}
+
+bool sclx_json_reader::read_int(std::int64_t& value) {
+    if (peek('n')) {
+        value = 0;
+        return read_literal("null");
+    }
+    bool neg = false;
+    if (m_pos < m_end && '-' == *m_pos) {
+        neg = true;
+        m_pos++;
+    }
+    const char* digits = m_pos;
+    value = 0;
+    while (m_pos < m_end && *m_pos >= '0' && *m_pos <= '9') {
+        if (m_pos - digits >= 18) {
+            // way out of range for any command value
+            return fail();
+        }
+        value = value * 10 + (*m_pos++ - '0');
+    }
+    if (m_pos == digits) {
+        return fail();
+    }
+    if (m_pos < m_end && '.' == *m_pos) {
+        const char* fraction = ++m_pos;
+        while (m_pos < m_end && *m_pos >= '0' && *m_pos <= '9') {
+            m_pos++;
+        }
+        if (m_pos == fraction) {
+            return fail();
+        }
+    }
+    if (m_pos < m_end && ('e' == *m_pos || 'E' == *m_pos)) {
+        // not used by the web ui
+        return fail();
+    }
+    if (neg) {
+        value = -value;
+    }
+    return true;
+}
+
+bool sclx_json_reader::read_bool(bool& value) {
+    value = false;
+    if (peek('t')) {
+        value = true;
+        return read_literal("true");
+    } else if (peek('f')) {
+        return read_literal("false");
+    }
+    return read_literal("null");
+}
+
+bool sclx_json_reader::skip() {
+    if (peek('"')) {
+        slice_t s;
+        return read_string(s);
+    } else if (peek('{') || peek('[')) {
+        if (m_depth >= MAX_DEPTH) {
+            return fail();
+        }
+        m_depth++;
+        if (peek('{')) {
+            slice_t key;
+            begin_object();
+            while (next_member(key) && skip()) {
+            }
+        } else {
+            begin_array();
+            while (next_element() && skip()) {
+            }
+        }
+        m_depth--;
+        return !m_error;
+    } else if (peek('t')) {
+        return read_literal("true");
+    } else if (peek('f')) {
+        return read_literal("false");
+    } else if (peek('n')) {
+        return read_literal("null");
+    }
+    // number
+    const char* start = m_pos;
+    bool digit = false;
+    while (m_pos < m_end) {
+        char c = *m_pos;
+        if (c >= '0' && c <= '9') {
+            digit = true;
+        } else if (c != '-' && c != '+' && c != '.' && c != 'e' && c != 'E') {
+            break;
+        }
+        m_pos++;
+    }
+    if (m_pos == start || !digit) {
+        return fail();
+    }
+    return true;
+}
+
+bool sclx_json_reader::read_literal(const char* literal) {
+    skip_ws();
+    std::size_t len = std::strlen(literal);
+    if (static_cast<std::size_t>(m_end - m_pos) < len || std::memcmp(m_pos, literal, len) != 0) {
+        return fail();
+    }
+    m_pos += len;
+    return true;
+}
+
+namespace sclx_cmd {
+
+namespace {
+
+bool read_int(sclx_json_reader& in, int& value, std::int64_t min, std::int64_t max) {
+    std::int64_t v;
+    if (!in.read_int(v) || v < min || v > max) {
+        return false;
+    }
+    value = v;
+    return true;
+}
+
+// the web ui sends the driver of a controller as a string when it was picked in the select box
+bool read_int_or_string(sclx_json_reader& in, int& value, std::int64_t min, std::int64_t max) {
+    if (!in.peek('"')) {
+        return read_int(in, value, min, max);
+    }
+    sclx_json_reader::slice_t s;
+    if (!in.read_string(s)) {
+        return false;
+    }
+    sclx_json_reader num(s.data, s.data + s.size);
+    std::int64_t v;
+    if (!num.read_int(v) || !num.at_end() || v < min || v > max) {
+        return false;
+    }
+    value = v;
+    return true;
+}
+
+template <typename T>
+bool parse_list(sclx_json_reader& in, std::vector<T>& list, bool (*parse_item)(sclx_json_reader&, T&)) {
+    list.clear();
+    if (in.peek('n')) {
+        return in.skip();
+    }
+    if (!in.begin_array()) {
+        return false;
+    }
+    while (in.next_element()) {
+        list.emplace_back();
+        if (!parse_item(in, list.back())) {
+            return false;
+        }
+    }
+    return !in.error();
+}
+
+bool parse_driver(sclx_json_reader& in, driver_t& driver) {
+    sclx_json_reader::slice_t key;
+    if (!in.begin_object()) {
+        return false;
+    }
+    while (in.next_member(key)) {
+        bool ok;
+        if (key.equals("id")) {
+            ok = read_int(in, driver.id, 0, 255);
+        } else if (key.equals("name")) {
+            ok = in.read_string(driver.name);
+        } else if (key.equals("power")) {
+            ok = read_int(in, driver.power, 1, 100);
+        } else if (key.equals("curve")) {
+            ok = in.read_string(driver.curve);
+        } else if (key.equals("image")) {
+            ok = in.read_string(driver.image);
+        } else {
+            ok = in.skip();
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return !in.error();
+}
+
+bool parse_controller(sclx_json_reader& in, controller_t& ctrl) {
+    sclx_json_reader::slice_t key;
+    if (!in.begin_object()) {
+        return false;
+    }
+    while (in.next_member(key)) {
+        bool ok;
+        if (key.equals("id")) {
+            ok = read_int(in, ctrl.id, 0, sclx::LANES - 1);
+        } else if (key.equals("driver")) {
+            ok = read_int_or_string(in, ctrl.driver, 0, 255);
+        } else {
+            ok = in.skip();
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return !in.error();
+}
+
+// sound files are relative to the web ui directory
+bool valid_sound_file(const std::string& file) {
+    if (file.empty() || '/' == file[0] || file.find("..") != std::string::npos) {
+        return false;
+    }
+    for (char c : file) {
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-' ||
+              c == '.' || c == '/')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parse_topic(sclx_json_reader& in, std::uint32_t& topics) {
+    std::string name;
+    if (!in.read_string(name)) {
+        return false;
+    }
+    sclx_topic::topic_t topic = sclx_topic::from_string(name);
+    if (sclx_topic::NUM_TOPICS == topic) {
+        return false;
+    }
+    topics |= 1 << topic;
+    return true;
+}
+
+bool parse_lane(sclx_json_reader& in, std::uint8_t& lanes) {
+    int lane;
+    if (!read_int(in, lane, 0, sclx::LANES - 1)) {
+        return false;
+    }
+    lanes |= 1 << lane;
+    return true;
+}
+
+}  // namespace
+
+bool parse_type(const char* begin, const char* end, sclx_json_reader::slice_t& type) {
+    sclx_json_reader in(begin, end);
+    sclx_json_reader::slice_t key;
+    if (!in.begin_object()) {
+        return false;
+    }
+    while (in.next_member(key)) {
+        if (key.equals("type")) {
+            return in.read_string(type);
+        } else if (!in.skip()) {
+            return false;
+        }
+    }
+    return false;
+}
+
+bool parse(sclx_json_reader& in, settings_t& cmd) {
+    sclx_json_reader::slice_t key;
+    if (!in.begin_object()) {
+        return false;
+    }
+    while (in.next_member(key)) {
+        bool ok;
+        if (key.equals("drivers")) {
+            ok = parse_list(in, cmd.drivers, parse_driver);
+        } else if (key.equals("controllers")) {
+            ok = parse_list(in, cmd.controllers, parse_controller);
+        } else if (key.equals("digital_car_mode")) {
+            ok = in.read_bool(cmd.digital_car_mode);
+        } else {
+            ok = in.skip();
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return !in.error();
+}
+
+bool parse(sclx_json_reader& in, bind_car_t& cmd) {
+    sclx_json_reader::slice_t key;
+    if (!in.begin_object()) {
+        return false;
+    }
+    while (in.next_member(key)) {
+        if (!(key.equals("id") ? read_int(in, cmd.id, 0, sclx::LANES - 1) : in.skip())) {
+            return false;
+        }
+    }
+    return !in.error();
+}
+
+bool parse(sclx_json_reader& in, latency_t& cmd) {
+    sclx_json_reader::slice_t key;
+    if (!in.begin_object()) {
+        return false;
+    }
+    while (in.next_member(key)) {
+        if (!(key.equals("reset") ? in.read_bool(cmd.reset) : in.skip())) {
+            return false;
+        }
+    }
+    return !in.error();
+}
+
+bool parse(sclx_json_reader& in, play_sound_t& cmd) {
+    sclx_json_reader::slice_t key;
+    if (!in.begin_object()) {
+        return false;
+    }
+    while (in.next_member(key)) {
+        if (!(key.equals("file") ? in.read_string(cmd.file) : in.skip())) {
+            return false;
+        }
+    }
+    return !in.error() && valid_sound_file(cmd.file);
+}
+
+bool parse(sclx_json_reader& in, subscribe_t& cmd) {
+    sclx_json_reader::slice_t key;
+    if (!in.begin_object()) {
+        return false;
+    }
+    while (in.next_member(key)) {
+        bool ok = true;
+        if (key.equals("topics")) {
+            cmd.topics = 0;
+            if (in.begin_array()) {
+                while (ok && in.next_element()) {
+                    ok = parse_topic(in, cmd.topics);
+                }
+            }
+        } else if (key.equals("lanes")) {
+            cmd.lanes = 0;
+            if (in.begin_array()) {
+                while (ok && in.next_element()) {
+                    ok = parse_lane(in, cmd.lanes);
+                }
+            }
+        } else if (key.equals("positions_interval")) {
+            ok = read_int(in, cmd.positions_interval, 100, 60000);
+        } else {
+            ok = in.skip();
+        }
+        if (!ok || in.error()) {
+            return false;
+        }
+    }
+    return !in.error();
+}
+
+bool parse(sclx_json_reader& in, ghost_t& cmd) {
+    sclx_json_reader::slice_t key;
+    if (!in.begin_object()) {
+        return false;
+    }
+    while (in.next_member(key)) {
+        if (!(key.equals("lane") ? read_int(in, cmd.lane, -1, sclx::LANES - 1) : in.skip())) {
+            return false;
+        }
+    }
+    return !in.error();
+}
+
+bool parse(const char* begin, const char* end, handset_t& cmd) {
+    if (end - begin != static_cast<std::ptrdiff_t>(handset_t::SIZE) || begin[0] != handset_t::TAG) {
+        return false;
+    }
+    const std::uint8_t* p = reinterpret_cast<const std::uint8_t*>(begin);
+    cmd.lane = p[1];
+    cmd.power = p[2];
+    cmd.flags = p[3];
+    cmd.stamp = p[4] | p[5] << 8 | p[6] << 16 | static_cast<std::uint32_t>(p[7]) << 24;
+    return cmd.lane < sclx::LANES && cmd.power <= sclx::POWER;
+}
+
+}  // namespace sclx_cmd
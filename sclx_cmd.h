@@ -0,0 +1,209 @@
+#ifndef SCLX_CMD_H_
+#define SCLX_CMD_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "sclx_lanes.h"
+#include "sclx_subscriptions.h"
+
+// Pull parser for the inbound websocket commands. It works in place on the message buffer, strings are returned as
+// slices into the buffer and only copied (and unescaped) where a command keeps them. Any syntax error sets the
+// error flag and makes all following reads fail.
+class sclx_json_reader {
+  public:
+    struct slice_t {
+        const char* data;
+        std::size_t size;
+
+        inline bool equals(const char* str) const {
+            return std::strlen(str) == size && std::memcmp(data, str, size) == 0;
+        }
+    };
+
+    sclx_json_reader(const char* begin, const char* end)
+        : m_pos(begin), m_end(end), m_depth(0), m_fresh(false), m_error(false) {}
+
+    inline bool error() const { return m_error; }
+
+    // objects: if (in.begin_object()) { while (in.next_member(key)) { read or skip the value } }
+    inline bool begin_object() { return begin('{'); }
+    inline bool next_member(slice_t& key) { return next('}') && read_string(key) && expect(':'); }
+
+    // arrays: if (in.begin_array()) { while (in.next_element()) { read or skip the value } }
+    inline bool begin_array() { return begin('['); }
+    inline bool next_element() { return next(']'); }
+
+    // the raw string, escape sequences are not decoded
+    bool read_string(slice_t& value);
+    // the decoded string
+    bool read_string(std::string& value);
+    // an integer, null reads as 0 and a number with a fraction gets truncated
+    bool read_int(std::int64_t& value);
+    // null reads as false
+    bool read_bool(bool& value);
+    // skip any value
+    bool skip();
+
+    inline bool peek(char c) {
+        skip_ws();
+        return m_pos < m_end && *m_pos == c;
+    }
+
+    inline bool at_end() {
+        skip_ws();
+        return m_pos == m_end;
+    }
+
+  private:
+    const char* m_pos;
+    const char* m_end;
+    // nesting of skipped values
+    int m_depth;
+    // a container was just opened, so the next element must not have a comma
+    bool m_fresh;
+    bool m_error;
+
+    inline bool fail() {
+        m_error = true;
+        m_pos = m_end;
+        return false;
+    }
+
+    inline void skip_ws() {
+        while (m_pos < m_end && (*m_pos == ' ' || *m_pos == '\t' || *m_pos == '\n' || *m_pos == '\r')) {
+            m_pos++;
+        }
+    }
+
+    inline bool expect(char c) {
+        if (!peek(c)) {
+            return fail();
+        }
+        m_pos++;
+        return true;
+    }
+
+    inline bool begin(char c) {
+        if (!expect(c)) {
+            return false;
+        }
+        m_fresh = true;
+        return true;
+    }
+
+    inline bool next(char close) {
+        if (m_error) {
+            return false;
+        }
+        if (peek(close)) {
+            m_pos++;
+            m_fresh = false;
+            return false;
+        }
+        if (!m_fresh && !expect(',')) {
+            return false;
+        }
+        m_fresh = false;
+        return true;
+    }
+
+    bool read_literal(const char* literal);
+};
+
+// typed commands, the values are validated while parsing
+namespace sclx_cmd {
+
+struct driver_t {
+    int id = 0;
+    std::string name;
+    int power = 100;  // percent, 1-100
+    std::string curve;
+    std::string image;
+};
+
+struct controller_t {
+    int id = 0;
+    int driver = 0;
+};
+
+struct settings_t {
+    std::vector<driver_t> drivers;
+    std::vector<controller_t> controllers;
+    bool digital_car_mode = false;
+};
+
+struct bind_car_t {
+    int id = 0;
+};
+
+struct latency_t {
+    bool reset = false;
+};
+
+struct play_sound_t {
+    std::string file;
+};
+
+// start the ghost car on a lane, -1 stops it
+struct ghost_t {
+    int lane = -1;
+};
+
+struct subscribe_t {
+    std::uint32_t topics = 0;     // bit mask of sclx_topic::topic_t
+    std::uint8_t lanes = sclx_lanes::ALL;  // lane mask, all lanes if not given
+    int positions_interval = 1000;  // ms
+};
+
+// Binary frame of a virtual handset, 8 bytes: 'H', lane, power (0-63), flags, client stamp (32 bits, little
+// endian). The stamp is opaque to the server, it is echoed in the acknowledgement the client asks for with ACK.
+struct handset_t {
+    static constexpr std::size_t SIZE = 8;
+    static constexpr char TAG = 'H';
+    static constexpr std::uint8_t BRAKE = 1;
+    static constexpr std::uint8_t LANE_CHANGE = 2;
+    static constexpr std::uint8_t ACK = 128;
+
+    std::uint8_t lane = 0;
+    std::uint8_t power = 0;
+    std::uint8_t flags = 0;
+    std::uint32_t stamp = 0;
+};
+
+// Acknowledgement of a handset frame, 8 bytes: 'A', lane, status, 0, the stamp of the frame
+struct handset_ack_t {
+    static constexpr std::size_t SIZE = 8;
+    static constexpr char TAG = 'A';
+    // the lane is driven by another client or a physical handset
+    static constexpr std::uint8_t REJECTED = 1;
+
+    static void write(char* out, std::uint8_t lane, std::uint8_t status, std::uint32_t stamp) {
+        out[0] = TAG;
+        out[1] = lane;
+        out[2] = status;
+        out[3] = 0;
+        for (int i = 0; i < 4; i++) {
+            out[4 + i] = static_cast<char>(stamp >> (8 * i));
+        }
+    }
+};
+
+// the type of a command, the members of the command object are scanned without parsing the values
+bool parse_type(const char* begin, const char* end, sclx_json_reader::slice_t& type);
+
+// parse and validate the members of a command object, the type member is ignored
+bool parse(sclx_json_reader& in, settings_t& cmd);
+bool parse(sclx_json_reader& in, bind_car_t& cmd);
+bool parse(sclx_json_reader& in, latency_t& cmd);
+bool parse(sclx_json_reader& in, play_sound_t& cmd);
+bool parse(sclx_json_reader& in, subscribe_t& cmd);
+bool parse(sclx_json_reader& in, ghost_t& cmd);
+// a binary frame
+bool parse(const char* begin, const char* end, handset_t& cmd);
+
+}  // namespace sclx_cmd
+
+#endif  // SCLX_CMD_H_
@@ -1,7 +1,13 @@
 #ifndef SCLX_CONSTS_H_
 #define SCLX_CONSTS_H_
 
+#include <cstdint>
+
 struct sclx {
+    // Controllers/lanes of the powerbase, sizes every per lane array of the race engine
+    static constexpr std::uint8_t LANES = 6;
+    // handset/drive slots of the wire packets, the protocol always has 6 whatever lanes the base drives
+    static constexpr std::uint8_t WIRE_SLOTS = 6;
     // Operation
     static constexpr std::uint8_t OP_DRIVE = 0xff;
     static constexpr std::uint8_t OP_AUX = 0xbf;
@@ -32,6 +38,13 @@ struct sclx {
     static constexpr std::uint8_t BTN_LEFT = 1 << 4;
     static constexpr std::uint8_t BTN_DOWN = 1 << 5;
     static constexpr std::uint8_t PB_ANALOG_DIGITAL = 1 << 7;
+
+    // LED of a lane in the led status byte and handset of a lane in the status byte, 0 based
+    static constexpr std::uint8_t led(std::uint8_t lane) { return 1 << lane; }
+    static constexpr std::uint8_t handset(std::uint8_t lane) { return 1 << (lane + 1); }
 };
 
+// the lane LEDs share the led status byte with the green and red light
+static_assert(sclx::LANES >= 1 && sclx::LANES <= sclx::WIRE_SLOTS, "the powerbase protocol has room for 1 to 6 lanes");
+
 #endif  // SCLX_CONSTS_H_
@@ -5,6 +5,7 @@
 #include <tasks/worker.h>
 
 #include "sclx_task.h"
+#include "sclx_trace.h"
 
 class sclx_cycle_task : public tasks::timer_task {
   public:
@@ -17,6 +18,11 @@ class sclx_cycle_task : public tasks::timer_task {
             tdbg("sclx_cycle_task: no update for " << dif << " seconds" << std::endl);
             m_task->cycle_reset(worker);
         }
+        if (sclx_trace::dump_requested()) {
+            if (sclx_trace::dump("sclx_trace.json")) {
+                terr("sclx_cycle_task: wrote sclx_trace.json" << std::endl);
+            }
+        }
         return true;
     }
 
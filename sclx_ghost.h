@@ -0,0 +1,132 @@
+#ifndef SCLX_GHOST_H_
+#define SCLX_GHOST_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "sclx_consts.h"
+
+// Ghost car: the handset bytes of a lap, one per powerbase cycle, recorded on the serial thread and played back on
+// an idle lane. A lap is stored as runs of unchanged bytes, the player expands them before the playback starts.
+namespace sclx_ghost {
+
+// a handset byte and the number of cycles it was held
+struct run_t {
+    std::uint16_t cycles;
+    std::uint8_t handset;
+};
+
+// the handset trace of a lap from the start/finish line to the start/finish line
+struct lap_t {
+    std::uint8_t carid = 0;
+    std::uint64_t lap_time = 0;  // us
+    std::uint32_t cycles = 0;
+    std::vector<run_t> runs;
+};
+
+// Records the lap of one lane. The buffers are reserved up front, so the serial thread never allocates while recording
+// or handing a lap over. A lap with more runs than fit is dropped.
+class recorder {
+  public:
+    static constexpr std::size_t MAX_RUNS = 8192;
+
+    recorder() : m_spare_buffer(new std::vector<run_t>()), m_spare(m_spare_buffer.get()) {
+        m_runs.reserve(MAX_RUNS);
+        m_spare_buffer->reserve(MAX_RUNS);
+    }
+
+    // start a new lap at the start/finish line
+    inline void restart() {
+        m_runs.clear();
+        m_cycles = 0;
+        m_valid = true;
+    }
+
+    inline bool valid() const { return m_valid; }
+    inline std::uint32_t cycles() const { return m_cycles; }
+
+    // the handset byte of this cycle, cycles > 1 if packets got lost since the last one
+    inline void record(std::uint8_t handset, std::uint16_t cycles) {
+        if (!m_valid) {
+            return;
+        }
+        m_cycles += cycles;
+        if (!m_runs.empty() && m_runs.back().handset == handset && m_runs.back().cycles <= 0xffff - cycles) {
+            m_runs.back().cycles += cycles;
+        } else if (m_runs.size() < MAX_RUNS) {
+            m_runs.push_back({cycles, handset});
+        } else {
+            m_valid = false;
+        }
+    }
+
+    // Hand the recorded runs over to another thread, they get swapped with the spare buffer. nullptr while the
+    // previous lap is still out, a lane sets a new best lap once per lap at most, so that does not happen in practice.
+    inline std::vector<run_t>* take() {
+        std::vector<run_t>* runs = m_spare.exchange(nullptr, std::memory_order_acquire);
+        if (nullptr != runs) {
+            runs->swap(m_runs);
+        }
+        return runs;
+    }
+
+    // build the lap from runs returned by take() and give the buffer back, called by the other thread
+    std::shared_ptr<const lap_t> lap(std::vector<run_t>* runs, std::uint8_t carid, std::uint64_t lap_time,
+                                     std::uint32_t cycles) {
+        auto lap = std::make_shared<lap_t>();
+        lap->carid = carid;
+        lap->lap_time = lap_time;
+        lap->cycles = cycles;
+        lap->runs = *runs;
+        runs->clear();
+        m_spare.store(runs, std::memory_order_release);
+        return lap;
+    }
+
+  private:
+    std::vector<run_t> m_runs;
+    std::uint32_t m_cycles = 0;
+    bool m_valid = false;
+    // the buffer that is not recording, m_spare is null while it is out
+    std::unique_ptr<std::vector<run_t>> m_spare_buffer;
+    std::atomic<std::vector<run_t>*> m_spare;
+};
+
+// Plays a lap back on a lane, a cycle costs a load and an increment. The player without a lap stops the playback.
+class player {
+  public:
+    player() : m_carid(sclx::LANES) {}
+
+    player(std::uint8_t carid, const lap_t& lap) : m_carid(carid) {
+        m_bytes.reserve(lap.cycles);
+        for (auto& run : lap.runs) {
+            m_bytes.insert(m_bytes.end(), run.cycles, run.handset);
+        }
+    }
+
+    inline std::uint8_t carid() const { return m_carid; }
+    inline bool empty() const { return m_bytes.empty(); }
+
+    // back to the start/finish line
+    inline void rewind() { m_pos = 0; }
+
+    // the handset byte of the next cycle, skip is the number of lost packets. The last byte is held until the car
+    // crosses the line and the lap starts again.
+    inline std::uint8_t next(std::uint32_t skip) {
+        m_pos += skip;
+        std::uint8_t handset = m_pos < m_bytes.size() ? m_bytes[m_pos] : m_bytes.back();
+        m_pos++;
+        return handset;
+    }
+
+  private:
+    std::uint8_t m_carid;
+    std::vector<std::uint8_t> m_bytes;
+    std::size_t m_pos = 0;
+};
+
+}  // namespace sclx_ghost
+
+#endif  // SCLX_GHOST_H_
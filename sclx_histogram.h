@@ -0,0 +1,110 @@
+#ifndef SCLX_HISTOGRAM_H_
+#define SCLX_HISTOGRAM_H_
+
+#include <atomic>
+#include <cstdint>
+
+// HDR style histogram with log linear buckets (about 3% precision) for values up to 2^24 (e.g. 16s in
+// microseconds). Recording is lock free, one writer and any number of readers.
+class sclx_histogram {
+  public:
+    static constexpr int SUB_BITS = 6;
+    static constexpr std::uint64_t SUB_COUNT = 1 << SUB_BITS;
+    static constexpr std::uint64_t HALF_COUNT = SUB_COUNT / 2;
+    static constexpr int MAX_BITS = 24;
+    static constexpr std::uint64_t MAX_VALUE = (1 << MAX_BITS) - 1;
+    static constexpr std::size_t COUNT = (MAX_BITS - SUB_BITS + 2) * HALF_COUNT;
+
+    sclx_histogram() { reset(); }
+
+    inline void record(std::uint64_t value) {
+        if (value > MAX_VALUE) {
+            value = MAX_VALUE;
+        }
+        m_counts[index(value)].fetch_add(1, std::memory_order_relaxed);
+        m_total.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+        if (value > m_max.load(std::memory_order_relaxed)) {
+            m_max.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    void reset() {
+        for (auto& c : m_counts) {
+            c.store(0, std::memory_order_relaxed);
+        }
+        m_total = 0;
+        m_sum = 0;
+        m_max = 0;
+    }
+
+    // add the values of another histogram, e.g. to merge the histograms of several threads
+    void add(const sclx_histogram& other) {
+        for (std::size_t i = 0; i < COUNT; i++) {
+            m_counts[i].fetch_add(other.m_counts[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        m_total.fetch_add(other.count(), std::memory_order_relaxed);
+        m_sum.fetch_add(other.m_sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        if (other.max() > max()) {
+            m_max.store(other.max(), std::memory_order_relaxed);
+        }
+    }
+
+    inline std::uint64_t count() const { return m_total.load(std::memory_order_relaxed); }
+    inline std::uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+
+    inline std::uint64_t mean() const {
+        std::uint64_t total = count();
+        return total > 0 ? m_sum.load(std::memory_order_relaxed) / total : 0;
+    }
+
+    // highest value of the bucket that contains the given percentile (0-100)
+    std::uint64_t percentile(double p) const {
+        std::uint64_t total = 0;
+        std::uint64_t counts[COUNT];
+        for (std::size_t i = 0; i < COUNT; i++) {
+            counts[i] = m_counts[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+        if (total == 0) {
+            return 0;
+        }
+        std::uint64_t rank = static_cast<std::uint64_t>(p / 100. * total + .5);
+        if (rank < 1) {
+            rank = 1;
+        }
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < COUNT; i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                std::uint64_t v = highest_value(i);
+                return v < max() ? v : max();
+            }
+        }
+        return max();
+    }
+
+  private:
+    std::atomic<std::uint64_t> m_counts[COUNT];
+    std::atomic<std::uint64_t> m_total;
+    std::atomic<std::uint64_t> m_sum;
+    std::atomic<std::uint64_t> m_max;
+
+    // the first bucket is linear, every following one covers twice the range with half the sub buckets
+    static inline std::size_t index(std::uint64_t value) {
+        int msb = 63 - __builtin_clzll(value | 1);
+        int bucket = msb < SUB_BITS ? 0 : msb - SUB_BITS + 1;
+        return bucket * HALF_COUNT + (value >> bucket);
+    }
+
+    static inline std::uint64_t highest_value(std::size_t index) {
+        if (index < SUB_COUNT) {
+            return index;
+        }
+        int bucket = index / HALF_COUNT - 1;
+        std::uint64_t sub = index - bucket * HALF_COUNT;
+        return ((sub + 1) << bucket) - 1;
+    }
+};
+
+#endif  // SCLX_HISTOGRAM_H_
@@ -5,18 +5,21 @@
 #include <cstring>
 
 #include "crc.h"
+#include "sclx_consts.h"
+#include "sclx_transport.h"
 
 class sclx_in {
   public:
     struct __attribute__((__packed__)) packet_t {
         std::uint8_t status;
-        std::uint8_t handset[6];
+        std::uint8_t handset[sclx::WIRE_SLOTS];
         std::uint8_t aux_current;
         std::uint8_t carid_sf;
         std::uint32_t game_time_sf;
         std::uint8_t button_status;
         std::uint8_t crc;
     };
+    static_assert(sizeof(packet_t) == 15, "the powerbase sends 15 byte packets");
 
     sclx_in() {
         m_data_p = reinterpret_cast<char*>(&m_packet.status);
@@ -24,8 +27,8 @@ class sclx_in {
         std::memset(m_data_p, 0, m_size);
     }
 
-    inline void read(tasks::serial::term& term) {
-        std::streamsize bytes = term.read(m_data_p + m_read, m_size - m_read);
+    inline void read(sclx_transport& transport) {
+        std::streamsize bytes = transport.read(m_data_p + m_read, m_size - m_read);
         if (bytes >= 0) {
             m_read += bytes;
         } else {
@@ -0,0 +1,261 @@
+#ifndef SCLX_JSON_H_
+#define SCLX_JSON_H_
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Encoder for the fixed schema race events that are sent many times per second. It writes straight into a reused
+// buffer and produces exactly what Json::FastWriter produces for the same message: no white space, keys in
+// alphabetical order (the order of the jsoncpp object map) and a trailing newline. Fields have to be added in
+// alphabetical key order.
+class sclx_json_writer {
+  public:
+    explicit sclx_json_writer(std::string& buf) : m_buf(buf), m_first(true) {
+        m_buf.clear();
+        m_buf += '{';
+    }
+
+    template <std::size_t N>
+    inline sclx_json_writer& field(const char (&key)[N], bool value) {
+        add_key(key);
+        if (value) {
+            m_buf.append("true", 4);
+        } else {
+            m_buf.append("false", 5);
+        }
+        return *this;
+    }
+
+    template <std::size_t N, typename T>
+    inline typename std::enable_if<std::is_integral<T>::value, sclx_json_writer&>::type field(const char (&key)[N],
+                                                                                              T value) {
+        add_key(key);
+        add_number(value);
+        return *this;
+    }
+
+    template <std::size_t N>
+    inline sclx_json_writer& field(const char (&key)[N], const std::string& value) {
+        add_key(key);
+        add_string(value.data(), value.size());
+        return *this;
+    }
+
+    template <std::size_t N>
+    inline sclx_json_writer& field(const char (&key)[N], const char* value) {
+        add_key(key);
+        add_string(value, std::char_traits<char>::length(value));
+        return *this;
+    }
+
+    template <std::size_t N>
+    inline sclx_json_writer& field(const char (&key)[N], const std::vector<std::uint8_t>& values) {
+        add_key(key);
+        m_buf += '[';
+        for (std::size_t i = 0; i < values.size(); i++) {
+            if (i > 0) {
+                m_buf += ',';
+            }
+            add_number(values[i]);
+        }
+        m_buf += ']';
+        return *this;
+    }
+
+    inline std::string& finish() {
+        m_buf.append("}\n", 2);
+        return m_buf;
+    }
+
+  private:
+    std::string& m_buf;
+    bool m_first;
+
+    template <std::size_t N>
+    inline void add_key(const char (&key)[N]) {
+        if (!m_first) {
+            m_buf += ',';
+        }
+        m_first = false;
+        m_buf += '"';
+        m_buf.append(key, N - 1);
+        m_buf.append("\":", 2);
+    }
+
+    template <typename T>
+    inline typename std::enable_if<std::is_signed<T>::value>::type add_number(T value) {
+        if (value < 0) {
+            m_buf += '-';
+            add_digits(0 - static_cast<std::uint64_t>(value));
+        } else {
+            add_digits(value);
+        }
+    }
+
+    template <typename T>
+    inline typename std::enable_if<std::is_unsigned<T>::value>::type add_number(T value) {
+        add_digits(value);
+    }
+
+    inline void add_digits(std::uint64_t value) {
+        char digits[20];
+        char* p = digits + sizeof(digits);
+        do {
+            *--p = '0' + value % 10;
+            value /= 10;
+        } while (value > 0);
+        m_buf.append(p, digits + sizeof(digits) - p);
+    }
+
+    // same escaping as jsoncpp 1.9: control characters and everything beyond ASCII as \u escapes, UTF-16 surrogate
+    // pairs beyond the BMP and U+FFFD for broken UTF-8
+    void add_string(const char* str, std::size_t len) {
+        m_buf += '"';
+        const char* end = str + len;
+        for (const char* s = str; s < end; s++) {
+            char c = *s;
+            switch (c) {
+                case '"':
+                    m_buf.append("\\\"", 2);
+                    break;
+                case '\\':
+                    m_buf.append("\\\\", 2);
+                    break;
+                case '\b':
+                    m_buf.append("\\b", 2);
+                    break;
+                case '\f':
+                    m_buf.append("\\f", 2);
+                    break;
+                case '\n':
+                    m_buf.append("\\n", 2);
+                    break;
+                case '\r':
+                    m_buf.append("\\r", 2);
+                    break;
+                case '\t':
+                    m_buf.append("\\t", 2);
+                    break;
+                default: {
+                    std::uint32_t cp = static_cast<unsigned char>(c);
+                    if (cp >= 0x80) {
+                        cp = codepoint(s, end);
+                    }
+                    if (cp >= 0x20 && cp < 0x80) {
+                        m_buf += c;
+                    } else if (cp < 0x10000) {
+                        add_hex(cp);
+                    } else {
+                        cp -= 0x10000;
+                        add_hex(0xd800 + ((cp >> 10) & 0x3ff));
+                        add_hex(0xdc00 + (cp & 0x3ff));
+                    }
+                }
+            }
+        }
+        m_buf += '"';
+    }
+
+    inline void add_hex(std::uint32_t unit) {
+        static const char hex[] = "0123456789abcdef";
+        char esc[6] = {'\\', 'u', hex[(unit >> 12) & 0xf], hex[(unit >> 8) & 0xf], hex[(unit >> 4) & 0xf],
+                       hex[unit & 0xf]};
+        m_buf.append(esc, sizeof(esc));
+    }
+
+    // decodes the UTF-8 sequence at s like jsoncpp does and leaves s on its last byte
+    static std::uint32_t codepoint(const char*& s, const char* end) {
+        const std::uint32_t REPLACEMENT = 0xfffd;
+        std::uint32_t first = static_cast<unsigned char>(*s);
+        auto cont = [s](int i) { return static_cast<std::uint32_t>(static_cast<unsigned char>(s[i])) & 0x3f; };
+        if (first < 0xe0) {
+            if (end - s < 2) {
+                return REPLACEMENT;
+            }
+            std::uint32_t cp = ((first & 0x1f) << 6) | cont(1);
+            s += 1;
+            return cp < 0x80 ? REPLACEMENT : cp;
+        }
+        if (first < 0xf0) {
+            if (end - s < 3) {
+                return REPLACEMENT;
+            }
+            std::uint32_t cp = ((first & 0x0f) << 12) | (cont(1) << 6) | cont(2);
+            s += 2;
+            return cp < 0x800 || (cp >= 0xd800 && cp <= 0xdfff) ? REPLACEMENT : cp;
+        }
+        if (first < 0xf8) {
+            if (end - s < 4) {
+                return REPLACEMENT;
+            }
+            std::uint32_t cp = ((first & 0x07) << 18) | (cont(1) << 12) | (cont(2) << 6) | cont(3);
+            s += 3;
+            return cp < 0x10000 ? REPLACEMENT : cp;
+        }
+        return REPLACEMENT;
+    }
+};
+
+// the race events, the buffer is reused by the caller
+namespace sclx_json {
+
+inline std::string& lap_count(std::string& buf, std::uint8_t carid, std::uint8_t lap, std::uint64_t lap_time,
+                              bool record) {
+    return sclx_json_writer(buf)
+        .field("id", carid)
+        .field("lap", lap)
+        .field("lap_time", lap_time)
+        .field("record", record)
+        .field("type", "lap_count")
+        .finish();
+}
+
+inline std::string& false_start(std::string& buf, std::uint64_t carid) {
+    return sclx_json_writer(buf).field("id", carid).field("type", "false_start").finish();
+}
+
+inline std::string& reaction(std::string& buf, std::uint8_t carid, std::int64_t reaction_time, bool jump_start) {
+    return sclx_json_writer(buf)
+        .field("id", carid)
+        .field("jump_start", jump_start)
+        .field("reaction_time", reaction_time)
+        .field("type", "reaction")
+        .finish();
+}
+
+inline std::string& game_update(std::string& buf, std::uint64_t game_time, const std::vector<std::uint8_t>& positions) {
+    return sclx_json_writer(buf)
+        .field("positions", positions)
+        .field("time", game_time)
+        .field("type", "game_update")
+        .finish();
+}
+
+inline std::string& game_state(std::string& buf, const std::string& state) {
+    return sclx_json_writer(buf).field("state", state).field("type", "game_state").finish();
+}
+
+inline std::string& controller_changed(std::string& buf, std::uint8_t id, bool connected, const std::string& image) {
+    return sclx_json_writer(buf)
+        .field("connected", connected)
+        .field("id", id)
+        .field("image", image)
+        .field("type", "controller_changed")
+        .finish();
+}
+
+inline std::string& handset(std::string& buf, std::uint8_t id, std::uint8_t power, bool brake, bool lane_change) {
+    return sclx_json_writer(buf)
+        .field("brake", brake)
+        .field("id", id)
+        .field("lane_change", lane_change)
+        .field("power", power)
+        .field("type", "handset")
+        .finish();
+}
+
+}  // namespace sclx_json
+
+#endif  // SCLX_JSON_H_
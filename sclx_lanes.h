@@ -0,0 +1,93 @@
+#ifndef SCLX_LANES_H_
+#define SCLX_LANES_H_
+
+#include <cstdint>
+#include <type_traits>
+
+#include "sclx_consts.h"
+
+// value repeated count times, every copy shifted left by shift bits against the previous one
+constexpr std::uint64_t sclx_repeat(std::uint64_t value, unsigned shift, unsigned count) {
+    return count == 0 ? 0 : value | sclx_repeat(value << shift, shift, count - 1);
+}
+
+// Bit parallel helpers to process all lanes of a powerbase packet at once. The handset/drive bytes are loaded into one
+// 64 bit word (lane n in byte n) and results are returned as lane masks (lane n in bit n). The masks and multipliers
+// are generated for the lane count, so the loops over the lanes have a fixed trip count and get unrolled.
+template <std::uint8_t N>
+struct sclx_lanes_n {
+    // the copies in bytes() would overlap for 8 lanes
+    static_assert(N >= 1 && N <= 7, "sclx_lanes_n handles 1 to 7 lanes");
+
+    static constexpr std::uint8_t LANES = N;
+    static constexpr std::uint8_t ALL = (1u << N) - 1;
+
+    static constexpr std::uint64_t ONES = sclx_repeat(1, 8, N);
+    static constexpr std::uint64_t BYTES = ONES * 0xff;
+    static constexpr std::uint64_t BRAKE_BITS = ONES * sclx::BRAKE;
+    static constexpr std::uint64_t LANE_CHANGE_BITS = ONES * sclx::LANE_CHANGE;
+    static constexpr std::uint64_t POWER_BITS = ONES * sclx::POWER;
+    // moves bit 8n to bit 56 + n
+    static constexpr std::uint64_t PACK = sclx_repeat(UINT64_C(1) << (56 - 7 * (N - 1)), 7, N);
+    // copies of a lane mask 7 bits apart, lane n ends up in bit 8n
+    static constexpr std::uint64_t SPREAD = sclx_repeat(1, 7, N);
+
+    struct changes_t {
+        std::uint8_t brake;
+        std::uint8_t lane_change;
+        std::uint8_t power;
+        std::uint8_t any;
+    };
+
+    // load the handset bytes, the powerbase sends them inverted. The compiler merges the byte loads into plain
+    // loads, a memcpy of an odd size would go through the stack and stall store forwarding.
+    static inline std::uint64_t load(const std::uint8_t* handset) {
+        return ~load_bytes(handset, std::integral_constant<unsigned, N>()) & BYTES;
+    }
+
+    // collect bit 7 of every byte into a lane mask
+    static inline std::uint8_t pack(std::uint64_t bits) {
+        return static_cast<std::uint8_t>((((bits >> 7) & ONES) * PACK) >> 56);
+    }
+
+    // handset n is reported in status bit n (1 based), the LED of lane n is bit n - 1
+    static inline std::uint8_t connected(std::uint8_t status) { return (status >> 1) & ALL; }
+    static inline std::uint8_t leds(std::uint8_t status) { return connected(status); }
+
+    // lanes that changed brake, lane change or power between two packets
+    static inline changes_t changes(std::uint64_t cur, std::uint64_t last) {
+        std::uint64_t diff = cur ^ last;
+        changes_t c;
+        c.brake = pack(diff & BRAKE_BITS);
+        c.lane_change = pack((diff & LANE_CHANGE_BITS) << 1);
+        // a non zero power field carries into bit 6, the fields are 6 bits wide so nothing spills into the
+        // next byte
+        c.power = pack(((diff & POWER_BITS) + POWER_BITS) << 1);
+        c.any = c.brake | c.lane_change | c.power;
+        return c;
+    }
+
+    // byte mask of the lanes in a lane mask
+    static inline std::uint64_t bytes(std::uint8_t mask) { return ((mask * SPREAD) & ONES) * 0xff; }
+
+    // handset byte of a lane from a loaded word
+    static inline std::uint8_t handset(std::uint64_t word, int lane) {
+        return static_cast<std::uint8_t>(word >> (8 * lane));
+    }
+
+    // index of the lowest lane in a mask, used to walk the set bits of a lane mask
+    static inline int first(std::uint8_t mask) { return __builtin_ctz(mask); }
+
+  private:
+    // the first I bytes as one expression, a loop does not get unrolled at -O2
+    template <unsigned I>
+    static inline std::uint64_t load_bytes(const std::uint8_t* handset, std::integral_constant<unsigned, I>) {
+        return load_bytes(handset, std::integral_constant<unsigned, I - 1>()) |
+               static_cast<std::uint64_t>(handset[I - 1]) << (8 * (I - 1));
+    }
+    static inline std::uint64_t load_bytes(const std::uint8_t*, std::integral_constant<unsigned, 0>) { return 0; }
+};
+
+using sclx_lanes = sclx_lanes_n<sclx::LANES>;
+
+#endif  // SCLX_LANES_H_
@@ -0,0 +1,139 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+//#define _WITH_PUT_TIME
+#define _WITH_SHORT_LOG
+#include <tasks/logging.h>
+
+#include "sclx_log.h"
+
+namespace {
+
+// format strings, {} prints a number, {b} on/off and {x} hex
+const char* const formats[sclx_log::NUM_MSGS] = {
+    "handset{}: brake {b}",        // HANDSET_BRAKE
+    "handset{}: lane change {b}",  // HANDSET_LANE_CHANGE
+    "handset{}: power {}",         // HANDSET_POWER
+    "update_buttons: btn=0x{x}",   // BUTTONS
+    "aux_current changed: {}",     // AUX_CURRENT
+    "virtual handset{}: no input for {}us, braking",  // VIRTUAL_STALE
+    "car{}: reaction time {}us, jump start {b}",      // REACTION
+};
+
+}  // namespace
+
+sclx_log::cell_t sclx_log::m_queue[QUEUE_SIZE];
+std::atomic<std::size_t> sclx_log::m_enqueue_pos(0);
+std::atomic<std::size_t> sclx_log::m_dequeue_pos(0);
+std::atomic<bool> sclx_log::m_debug(false);
+std::atomic<bool> sclx_log::m_running(false);
+std::atomic<std::uint64_t> sclx_log::m_dropped(0);
+std::thread sclx_log::m_thread;
+bool sclx_log::m_queue_ready = sclx_log::init_queue();
+
+bool sclx_log::init_queue() {
+    // a cell is free for the producer when its sequence equals the enqueue position
+    for (std::size_t i = 0; i < QUEUE_SIZE; i++) {
+        m_queue[i].seq.store(i, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+void sclx_log::start() {
+    const char* env = std::getenv("SCLX_DEBUG");
+    if (nullptr != env && std::strcmp(env, "0") != 0) {
+        m_debug = true;
+    }
+    if (!m_running.exchange(true)) {
+        m_thread = std::thread(run);
+    }
+}
+
+void sclx_log::stop() {
+    if (m_running.exchange(false)) {
+        m_thread.join();
+    }
+}
+
+// bounded multi producer queue (D. Vyukov), the background thread is the only consumer
+bool sclx_log::enqueue(const record_t& rec) {
+    std::size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    cell_t* cell;
+    for (;;) {
+        cell = &m_queue[pos & (QUEUE_SIZE - 1)];
+        std::size_t seq = cell->seq.load(std::memory_order_acquire);
+        std::intptr_t dif = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+        if (dif == 0) {
+            if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (dif < 0) {
+            // full
+            return false;
+        } else {
+            pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    cell->rec = rec;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool sclx_log::dequeue(record_t& rec) {
+    std::size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    cell_t& cell = m_queue[pos & (QUEUE_SIZE - 1)];
+    if (cell.seq.load(std::memory_order_acquire) != pos + 1) {
+        // empty
+        return false;
+    }
+    rec = cell.rec;
+    cell.seq.store(pos + QUEUE_SIZE, std::memory_order_release);
+    m_dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+    return true;
+}
+
+void sclx_log::write(const record_t& rec) {
+    std::ostringstream line;
+    int arg = 0;
+    for (const char* p = formats[rec.id]; *p; p++) {
+        if ('{' != *p) {
+            line << *p;
+            continue;
+        }
+        std::int64_t value = arg < MAX_ARGS ? rec.args[arg++] : 0;
+        p++;
+        if ('b' == *p) {
+            line << (value ? "on" : "off");
+            p++;
+        } else if ('x' == *p) {
+            line << std::hex << value << std::dec;
+            p++;
+        } else {
+            line << value;
+        }
+    }
+    terr(line.str() << std::endl);
+}
+
+void sclx_log::run() {
+    record_t rec;
+    std::uint64_t dropped_reported = 0;
+    for (;;) {
+        // read the flag first, so everything queued before stop() gets written
+        bool running = m_running;
+        while (dequeue(rec)) {
+            write(rec);
+        }
+        std::uint64_t dropped_now = dropped();
+        if (dropped_now != dropped_reported) {
+            terr("sclx_log: dropped " << dropped_now - dropped_reported << " messages" << std::endl);
+            dropped_reported = dropped_now;
+        }
+        if (!running) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef SCLX_LOG_H_
+#define SCLX_LOG_H_
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+// Deferred logging for the hot paths. A call site only copies a message id and its raw arguments into a
+// preallocated lock free queue, a background thread formats and writes the messages. If the queue is full,
+// messages get dropped and counted instead of blocking the serial cycle.
+//
+// Debug messages (SCLX_LOG_DBG) are disabled by default, set SCLX_DEBUG=1 in the environment to enable them.
+class sclx_log {
+  public:
+    enum msg_t : std::uint8_t {
+        HANDSET_BRAKE,
+        HANDSET_LANE_CHANGE,
+        HANDSET_POWER,
+        BUTTONS,
+        AUX_CURRENT,
+        VIRTUAL_STALE,
+        REACTION,
+        NUM_MSGS
+    };
+
+    static constexpr int MAX_ARGS = 3;
+    // queue size, power of two
+    static constexpr std::size_t QUEUE_SIZE = 4096;
+
+    struct record_t {
+        msg_t id;
+        std::int64_t args[MAX_ARGS];
+    };
+
+    static void start();
+    static void stop();
+
+    static inline bool debug() { return m_debug.load(std::memory_order_relaxed); }
+    static inline void set_debug(bool enable) { m_debug = enable; }
+
+    static inline std::uint64_t dropped() { return m_dropped.load(std::memory_order_relaxed); }
+
+    template <typename... Args>
+    static inline void push(msg_t id, Args... args) {
+        static_assert(sizeof...(Args) <= MAX_ARGS, "too many log arguments");
+        record_t rec = {id, {static_cast<std::int64_t>(args)...}};
+        if (!enqueue(rec)) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+  private:
+    struct cell_t {
+        std::atomic<std::size_t> seq;
+        record_t rec;
+    };
+
+    static cell_t m_queue[QUEUE_SIZE];
+    static std::atomic<std::size_t> m_enqueue_pos;
+    static std::atomic<std::size_t> m_dequeue_pos;
+    static std::atomic<bool> m_debug;
+    static std::atomic<bool> m_running;
+    static std::atomic<std::uint64_t> m_dropped;
+    static std::thread m_thread;
+    static bool m_queue_ready;
+
+    static bool init_queue();
+
+    static bool enqueue(const record_t& rec);
+    static bool dequeue(record_t& rec);
+    static void write(const record_t& rec);
+    static void run();
+};
+
+// log a message from a hot path
+#define SCLX_LOG(id, ...) sclx_log::push(sclx_log::id, ##__VA_ARGS__)
+
+// log a debug message from a hot path, the arguments are only evaluated if debug logging is enabled
+#define SCLX_LOG_DBG(id, ...)                             \
+    do {                                                  \
+        if (sclx_log::debug()) {                          \
+            sclx_log::push(sclx_log::id, ##__VA_ARGS__);  \
+        }                                                 \
+    } while (0)
+
+#endif  // SCLX_LOG_H_
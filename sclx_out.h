@@ -2,18 +2,21 @@
 #define SCLX_OUT_H_
 
 #include <tasks/serial/term.h>
+#include <cstring>
 
 #include "sclx_consts.h"
 #include "crc.h"
+#include "sclx_transport.h"
 
 class sclx_out {
   public:
     struct __attribute__((__packed__)) packet_t {
         std::uint8_t op_mode;
-        std::uint8_t drive[6];
+        std::uint8_t drive[sclx::WIRE_SLOTS];
         std::uint8_t led_status;
         std::uint8_t crc;
     };
+    static_assert(sizeof(packet_t) == 9, "the powerbase takes 9 byte packets");
 
     sclx_out() {
         m_data_p = reinterpret_cast<char*>(&m_packet.op_mode);
@@ -23,9 +26,12 @@ class sclx_out {
         m_packet.crc = 0;
     }
 
-    void write(tasks::serial::term& term) {
-        m_packet.crc = crc8(&m_packet.op_mode, m_size - 1);
-        std::streamsize bytes = term.write(m_data_p, m_size);
+    void write(sclx_transport& transport) {
+        if (m_written == 0) {
+            m_packet.crc = crc8(&m_packet.op_mode, m_size - 1);
+        }
+        // continue a partial write (sockets) where we stopped
+        std::streamsize bytes = transport.write(m_data_p + m_written, m_size - m_written);
         if (bytes >= 0) {
             m_written += bytes;
         } else {
@@ -35,6 +41,8 @@ class sclx_out {
     }
 
     bool done() { return m_written == m_size; }
+    // some bytes of the packet are out already
+    bool started() const { return m_written > 0; }
     void reset() { m_written = 0; }
 
     inline packet_t& packet() { return m_packet; }
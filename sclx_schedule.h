@@ -0,0 +1,265 @@
+#ifndef SCLX_SCHEDULE_H_
+#define SCLX_SCHEDULE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+
+#include <tasks/tasks_exception.h>
+
+#include "sclx_consts.h"
+#include "sclx_out.h"
+
+// Scheduler for the special outbound frames: LED sequences, AUX packets and everything else that is not just the
+// drive data. Any thread can queue a sequence of steps lock free, the serial thread composes the due steps into the
+// packet of each cycle.
+//
+// A step is due a number of cycles after the previous step of its sequence, so a sequence keeps its timing if one of
+// its steps has to wait. Sequences are served by priority, in queue order within a priority. LED overlays of several
+// sequences combine, a LED belongs to the sequence with the highest priority. An AUX packet takes the whole frame, it
+// waits for a cycle without LED overlays of a higher priority and holds back the lower ones. A step that does not fit
+// goes out in one of the next cycles. A sequence for a channel replaces the pending or running sequence of that
+// channel, an empty one just cancels it. Every channel has a slot that keeps the latest sequence, so a channel never
+// fills the queue. Only sequences without a channel are queued, push() refuses them if the queue is full.
+//
+// Nothing waits on a lock: a slot is a few cells and an atomic index of the latest one. A producer writes a free
+// cell and exchanges its index in, the serial thread exchanges the index out, the side that gets an index back owns
+// that cell.
+class sclx_out_schedule {
+  public:
+    enum kind_t : std::uint8_t { LEDS, AUX, EVENT };
+    enum channel_t : std::uint8_t { NO_CHANNEL, START_LIGHTS, CAR_MODE, BINDING };
+
+    static constexpr std::size_t MAX_STEPS = 4;
+    // sequences waiting for the serial thread, power of two
+    static constexpr std::size_t QUEUE_SIZE = 32;
+    static constexpr std::size_t MAX_RUNNING = 16;
+    // cells of a channel slot, producers writing the same channel at once beyond that get refused
+    static constexpr std::uint8_t SLOT_CELLS = 8;
+
+    struct step_t {
+        kind_t kind;
+        std::uint8_t set;      // LEDS: LEDs to switch on, AUX: the led status byte of the AUX packet
+        std::uint8_t clear;    // LEDS: LEDs to switch off
+        std::uint8_t event;    // EVENT: bit of the mask compose() returns (0-31)
+        std::uint16_t delay;   // cycles after the previous step, 0 for the same frame
+        std::uint16_t cycles;  // LEDS: frames the overlay lasts
+    };
+
+    struct sequence_t {
+        std::uint8_t priority;
+        channel_t channel;
+        std::uint8_t count;
+        step_t steps[MAX_STEPS];
+    };
+
+    static inline step_t leds(std::uint8_t set, std::uint8_t clear, std::uint16_t delay, std::uint16_t cycles = 1) {
+        return {LEDS, set, clear, 0, delay, cycles};
+    }
+    static inline step_t aux(std::uint8_t status, std::uint16_t delay) { return {AUX, status, 0, 0, delay, 1}; }
+    static inline step_t event(std::uint8_t id, std::uint16_t delay) { return {EVENT, 0, 0, id, delay, 0}; }
+
+    // throws tasks::tasks_exception for more than MAX_STEPS steps
+    static sequence_t sequence(std::uint8_t priority, channel_t channel, std::initializer_list<step_t> steps) {
+        if (steps.size() > MAX_STEPS) {
+            throw tasks::tasks_exception(tasks::tasks_error::UNSET, "sclx_out_schedule: too many steps");
+        }
+        sequence_t seq;
+        seq.priority = priority;
+        seq.channel = channel;
+        seq.count = 0;
+        for (auto& s : steps) {
+            seq.steps[seq.count++] = s;
+        }
+        return seq;
+    }
+
+    sclx_out_schedule() {
+        for (std::size_t i = 0; i < QUEUE_SIZE; i++) {
+            m_queue[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Queue a sequence from any thread, false if the queue is full. A sequence for a channel replaces the pending one,
+    // it is only refused while all cells of the slot are being written.
+    bool push(const sequence_t& seq) {
+        if (seq.channel != NO_CHANNEL) {
+            slot_t& slot = m_slots[seq.channel];
+            for (std::uint8_t i = 0; i < SLOT_CELLS; i++) {
+                slot_cell_t& cell = slot.cells[i];
+                bool used = false;
+                if (!cell.used.load(std::memory_order_relaxed) &&
+                    cell.used.compare_exchange_strong(used, true, std::memory_order_acquire)) {
+                    cell.sequence = seq;
+                    // a replaced sequence that the serial thread did not take is ours to free
+                    std::uint8_t replaced = slot.latest.exchange(i + 1, std::memory_order_acq_rel);
+                    if (replaced > 0) {
+                        slot.cells[replaced - 1].used.store(false, std::memory_order_release);
+                    }
+                    return true;
+                }
+            }
+            return false;
+        }
+        std::size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        cell_t* cell;
+        for (;;) {
+            cell = &m_queue[pos & (QUEUE_SIZE - 1)];
+            std::size_t seq_no = cell->seq.load(std::memory_order_acquire);
+            std::intptr_t dif = static_cast<std::intptr_t>(seq_no) - static_cast<std::intptr_t>(pos);
+            if (dif == 0) {
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->sequence = seq;
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Compose the op mode and the led status of the next packet on top of the given LEDs, called by the serial thread
+    // once per packet. Returns the events that are due as bit mask.
+    std::uint32_t compose(sclx_out::packet_t& packet, std::uint8_t leds) {
+        take_queued();
+        std::uint32_t events = 0;
+        std::uint8_t owned = 0;  // LEDs set by a sequence with a higher priority
+        bool aux = false;
+        std::uint8_t aux_status = 0;
+        for (std::size_t i = 0; i < m_running; i++) {
+            running_t& r = m_runs[i];
+            while (r.step < r.sequence.count && r.due <= m_cycle) {
+                const step_t& s = r.sequence.steps[r.step];
+                if (s.kind == EVENT) {
+                    events |= 1u << s.event;
+                } else if (aux || (s.kind == AUX && owned)) {
+                    // the frame is taken
+                    break;
+                } else if (s.kind == AUX) {
+                    aux = true;
+                    aux_status = s.set;
+                } else {
+                    leds = (leds & ~(s.clear & ~owned)) | (s.set & ~owned);
+                    owned |= s.set | s.clear;
+                    if (r.remaining > 1) {
+                        r.remaining--;
+                        break;
+                    }
+                }
+                next_step(r);
+            }
+        }
+        remove_if([](const running_t& r) { return r.step >= r.sequence.count; });
+        packet.op_mode = aux ? sclx::OP_AUX : sclx::OP_DRIVE;
+        packet.led_status = aux ? aux_status : leds;
+        m_cycle++;
+        return events;
+    }
+
+    // sequences taken over by the serial thread
+    inline std::size_t running() const { return m_running; }
+
+  private:
+    struct cell_t {
+        std::atomic<std::size_t> seq;
+        sequence_t sequence;
+    };
+
+    struct slot_cell_t {
+        std::atomic<bool> used{false};
+        sequence_t sequence;
+    };
+
+    // latest sequence of a channel
+    struct slot_t {
+        slot_cell_t cells[SLOT_CELLS];
+        std::atomic<std::uint8_t> latest{0};  // cell + 1, 0 if there is nothing pending
+    };
+
+    struct running_t {
+        sequence_t sequence;
+        std::uint8_t step;
+        std::uint16_t remaining;
+        std::uint64_t due;
+    };
+
+    // bounded multi producer queue (D. Vyukov) like the one of sclx_log, the serial thread is the only consumer
+    cell_t m_queue[QUEUE_SIZE];
+    std::atomic<std::size_t> m_enqueue_pos{0};
+    std::size_t m_dequeue_pos = 0;
+    slot_t m_slots[BINDING + 1];
+
+    // ordered by priority and queue order
+    running_t m_runs[MAX_RUNNING];
+    std::size_t m_running = 0;
+    std::uint64_t m_cycle = 0;
+
+    inline void next_step(running_t& r) {
+        if (++r.step < r.sequence.count) {
+            r.due = m_cycle + r.sequence.steps[r.step].delay;
+            r.remaining = r.sequence.steps[r.step].cycles;
+        }
+    }
+
+    template <typename P>
+    void remove_if(P pred) {
+        std::size_t n = 0;
+        for (std::size_t i = 0; i < m_running; i++) {
+            if (!pred(m_runs[i])) {
+                if (n != i) {
+                    m_runs[n] = m_runs[i];
+                }
+                n++;
+            }
+        }
+        m_running = n;
+    }
+
+    inline void start(const sequence_t& seq) {
+        if (seq.count > 0) {
+            std::size_t i = m_running;
+            while (i > 0 && m_runs[i - 1].sequence.priority < seq.priority) {
+                m_runs[i] = m_runs[i - 1];
+                i--;
+            }
+            m_runs[i].sequence = seq;
+            m_runs[i].step = 0;
+            m_runs[i].remaining = seq.steps[0].cycles;
+            m_runs[i].due = m_cycle + seq.steps[0].delay;
+            m_running++;
+        }
+    }
+
+    // Move the pending and queued sequences to the running ones. A full list leaves them pending or queued, a channel
+    // sequence always finds the place of the one it replaces.
+    void take_queued() {
+        for (std::uint8_t c = START_LIGHTS; c <= BINDING; c++) {
+            slot_t& slot = m_slots[c];
+            // only the serial thread takes the index out, it stays set until the exchange below
+            if (slot.latest.load(std::memory_order_relaxed) == 0) {
+                continue;
+            }
+            remove_if([c](const running_t& r) { return r.sequence.channel == c; });
+            if (m_running < MAX_RUNNING) {
+                slot_cell_t& cell = slot.cells[slot.latest.exchange(0, std::memory_order_acq_rel) - 1];
+                start(cell.sequence);
+                cell.used.store(false, std::memory_order_release);
+            }
+        }
+        while (m_running < MAX_RUNNING) {
+            cell_t& cell = m_queue[m_dequeue_pos & (QUEUE_SIZE - 1)];
+            if (cell.seq.load(std::memory_order_acquire) != m_dequeue_pos + 1) {
+                return;
+            }
+            start(cell.sequence);
+            cell.seq.store(m_dequeue_pos + QUEUE_SIZE, std::memory_order_release);
+            m_dequeue_pos++;
+        }
+    }
+};
+
+#endif  // SCLX_SCHEDULE_H_
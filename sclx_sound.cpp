@@ -0,0 +1,384 @@
+#include <dirent.h>
+#include <pthread.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifdef SCLX_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+//#define _WITH_PUT_TIME
+#define _WITH_SHORT_LOG
+#include <tasks/logging.h>
+#include <tasks/tasks_exception.h>
+
+#include "sclx_sound.h"
+
+namespace {
+
+inline tasks::tasks_exception sound_error(const std::string& what) {
+    return tasks::tasks_exception(tasks::tasks_error::UNSET, what);
+}
+
+inline std::int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+inline std::uint32_t le32(const unsigned char* p) { return p[0] | p[1] << 8 | p[2] << 16 | std::uint32_t(p[3]) << 24; }
+inline std::uint16_t le16(const unsigned char* p) { return p[0] | p[1] << 8; }
+
+inline void put_le32(std::ostream& out, std::uint32_t v) {
+    char b[4] = {char(v), char(v >> 8), char(v >> 16), char(v >> 24)};
+    out.write(b, 4);
+}
+
+inline void put_le16(std::ostream& out, std::uint16_t v) {
+    char b[2] = {char(v), char(v >> 8)};
+    out.write(b, 2);
+}
+
+// one sample of a PCM frame as 16 bit
+inline std::int16_t pcm16(const unsigned char* p, unsigned bits) {
+    switch (bits) {
+        case 8:
+            return static_cast<std::int16_t>((p[0] - 128) * 256);
+        case 16:
+            return static_cast<std::int16_t>(le16(p));
+        case 24:
+            return static_cast<std::int16_t>(le16(p + 1));
+        default:
+            return static_cast<std::int16_t>(le16(p + 2));
+    }
+}
+
+// paces the writes like a device would
+class clock_sink : public sclx_sound::sink {
+  public:
+    clock_sink() : m_next(std::chrono::steady_clock::now()) {}
+
+    bool write(const std::int16_t*, std::size_t count) override {
+        m_next += std::chrono::microseconds(count * 1000000 / sclx_sound::RATE);
+        std::this_thread::sleep_until(m_next);
+        return true;
+    }
+
+  private:
+    std::chrono::steady_clock::time_point m_next;
+};
+
+// records everything to a wav file, the sizes in the header are written when the sink is closed
+class file_sink : public clock_sink {
+  public:
+    explicit file_sink(const std::string& path) : m_out(path, std::ios::binary), m_frames(0) {
+        if (!m_out) {
+            throw sound_error("can't open " + path);
+        }
+        write_header();
+    }
+
+    ~file_sink() {
+        m_out.seekp(0);
+        write_header();
+    }
+
+    bool write(const std::int16_t* frames, std::size_t count) override {
+        for (std::size_t i = 0; i < count * sclx_sound::CHANNELS; i++) {
+            put_le16(m_out, static_cast<std::uint16_t>(frames[i]));
+        }
+        m_frames += count;
+        return m_out.good() && clock_sink::write(frames, count);
+    }
+
+  private:
+    std::ofstream m_out;
+    std::uint64_t m_frames;
+
+    void write_header() {
+        std::uint32_t data = static_cast<std::uint32_t>(m_frames * sclx_sound::CHANNELS * 2);
+        m_out.write("RIFF", 4);
+        put_le32(m_out, 36 + data);
+        m_out.write("WAVEfmt ", 8);
+        put_le32(m_out, 16);
+        put_le16(m_out, 1);
+        put_le16(m_out, sclx_sound::CHANNELS);
+        put_le32(m_out, sclx_sound::RATE);
+        put_le32(m_out, sclx_sound::RATE * sclx_sound::CHANNELS * 2);
+        put_le16(m_out, sclx_sound::CHANNELS * 2);
+        put_le16(m_out, 16);
+        m_out.write("data", 4);
+        put_le32(m_out, data);
+    }
+};
+
+#ifdef SCLX_ALSA
+class alsa_sink : public sclx_sound::sink {
+  public:
+    explicit alsa_sink(const std::string& device) : m_pcm(nullptr), m_underruns(0) {
+        int err = snd_pcm_open(&m_pcm, device.c_str(), SND_PCM_STREAM_PLAYBACK, 0);
+        if (err < 0) {
+            throw sound_error("can't open " + device + ": " + snd_strerror(err));
+        }
+        // 20ms device buffer, short enough for the start lights
+        err = snd_pcm_set_params(m_pcm, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED, sclx_sound::CHANNELS,
+                                 sclx_sound::RATE, 1, 20000);
+        if (err < 0) {
+            snd_pcm_close(m_pcm);
+            throw sound_error("can't configure " + device + ": " + snd_strerror(err));
+        }
+    }
+
+    ~alsa_sink() { snd_pcm_close(m_pcm); }
+
+    bool write(const std::int16_t* frames, std::size_t count) override {
+        while (count > 0) {
+            snd_pcm_sframes_t n = snd_pcm_writei(m_pcm, frames, count);
+            if (n < 0) {
+                if (-EPIPE == n) {
+                    m_underruns++;
+                }
+                if (snd_pcm_recover(m_pcm, static_cast<int>(n), 1) < 0) {
+                    terr("sclx_sound: " << snd_strerror(static_cast<int>(n)) << std::endl);
+                    return false;
+                }
+                continue;
+            }
+            frames += n * sclx_sound::CHANNELS;
+            count -= n;
+        }
+        return true;
+    }
+
+    std::uint64_t underruns() const override { return m_underruns; }
+
+  private:
+    snd_pcm_t* m_pcm;
+    std::atomic<std::uint64_t> m_underruns;
+};
+#endif
+
+}  // namespace
+
+std::unique_ptr<sclx_sound::sink> sclx_sound::make_sink(const std::string& spec) {
+    if (spec == "null") {
+        return std::unique_ptr<sink>(new clock_sink());
+    }
+    if (spec.compare(0, 5, "file:") == 0) {
+        return std::unique_ptr<sink>(new file_sink(spec.substr(5)));
+    }
+    if (spec == "alsa" || spec.compare(0, 5, "alsa:") == 0) {
+#ifdef SCLX_ALSA
+        return std::unique_ptr<sink>(new alsa_sink(spec.size() > 5 ? spec.substr(5) : "default"));
+#else
+        throw sound_error("compiled without ALSA");
+#endif
+    }
+    throw sound_error("unknown sound output " + spec);
+}
+
+void sclx_sound::load(const std::string& name, const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (data.size() < 12 || std::memcmp(&data[0], "RIFF", 4) != 0 || std::memcmp(&data[8], "WAVE", 4) != 0) {
+        throw sound_error(path + ": not a wav file");
+    }
+
+    // walk the chunks for the format and the samples
+    unsigned format = 0, channels = 0, bits = 0;
+    std::uint32_t rate = 0;
+    const unsigned char* pcm = nullptr;
+    std::size_t pcm_size = 0;
+    std::size_t pos = 12;
+    while (pos + 8 <= data.size()) {
+        std::size_t size = le32(&data[pos + 4]);
+        const unsigned char* chunk = data.data() + pos + 8;
+        size = std::min(size, data.size() - pos - 8);
+        if (std::memcmp(&data[pos], "fmt ", 4) == 0 && size >= 16) {
+            format = le16(chunk);
+            channels = le16(chunk + 2);
+            rate = le32(chunk + 4);
+            bits = le16(chunk + 14);
+            // WAVE_FORMAT_EXTENSIBLE, the sub format starts with the format tag
+            if (0xfffe == format && size >= 26) {
+                format = le16(chunk + 24);
+            }
+        } else if (std::memcmp(&data[pos], "data", 4) == 0) {
+            pcm = chunk;
+            pcm_size = size;
+        }
+        // chunks are padded to an even size
+        pos += 8 + size + (size & 1);
+    }
+    if (1 != format || channels < 1 || rate < 1000 || (8 != bits && 16 != bits && 24 != bits && 32 != bits)) {
+        throw sound_error(path + ": only PCM wav files are supported");
+    }
+    if (nullptr == pcm) {
+        throw sound_error(path + ": no data");
+    }
+
+    // stereo at the source rate, mono is played on both channels and further channels are dropped
+    std::size_t frame_size = channels * bits / 8;
+    std::size_t src_frames = pcm_size / frame_size;
+    std::vector<std::int16_t> src(src_frames * CHANNELS);
+    for (std::size_t i = 0; i < src_frames; i++) {
+        const unsigned char* frame = pcm + i * frame_size;
+        src[i * 2] = pcm16(frame, bits);
+        src[i * 2 + 1] = channels > 1 ? pcm16(frame + bits / 8, bits) : src[i * 2];
+    }
+
+    std::unique_ptr<sample_t> sample(new sample_t);
+    if (rate == RATE) {
+        sample->pcm = std::move(src);
+        sample->frames = src_frames;
+    } else {
+        // linear interpolation, done once here so the mixer only adds
+        std::size_t frames = static_cast<std::size_t>(std::uint64_t(src_frames) * RATE / rate);
+        sample->pcm.resize(frames * CHANNELS);
+        for (std::size_t i = 0; i < frames; i++) {
+            // source position in 16.16 fixed point
+            std::uint64_t p = (std::uint64_t(i) * rate << 16) / RATE;
+            std::size_t idx = p >> 16;
+            std::int64_t frac = p & 0xffff;
+            std::size_t next = idx + 1 < src_frames ? idx + 1 : idx;
+            for (unsigned c = 0; c < CHANNELS; c++) {
+                std::int64_t a = src[idx * CHANNELS + c];
+                std::int64_t b = src[next * CHANNELS + c];
+                sample->pcm[i * CHANNELS + c] = static_cast<std::int16_t>(a + (((b - a) * frac) >> 16));
+            }
+        }
+        sample->frames = frames;
+    }
+    m_samples[name] = std::move(sample);
+}
+
+std::size_t sclx_sound::load_dir(const std::string& dir, const std::string& prefix) {
+    DIR* d = opendir(dir.c_str());
+    if (nullptr == d) {
+        throw sound_error("can't open " + dir + ": " + std::strerror(errno));
+    }
+    std::vector<std::string> names;
+    while (auto entry = readdir(d)) {
+        std::string name = entry->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".wav") == 0) {
+            names.push_back(name);
+        }
+    }
+    closedir(d);
+    for (auto& name : names) {
+        load(prefix + name, dir + "/" + name);
+    }
+    return names.size();
+}
+
+std::size_t sclx_sound::memory() const {
+    std::size_t bytes = 0;
+    for (auto& s : m_samples) {
+        bytes += s.second->pcm.size() * sizeof(std::int16_t);
+    }
+    return bytes;
+}
+
+void sclx_sound::start(std::unique_ptr<sink> out) {
+    if (m_running.exchange(true)) {
+        return;
+    }
+    m_sink = std::move(out);
+    m_thread = std::thread([this] { run(); });
+    // the mixer should not wait for the race logic, this needs CAP_SYS_NICE or root
+    sched_param param;
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+    if (pthread_setschedparam(m_thread.native_handle(), SCHED_FIFO, &param) != 0) {
+        tdbg("sclx_sound: no realtime priority for the mixer" << std::endl);
+    }
+}
+
+void sclx_sound::stop() {
+    if (m_running.exchange(false)) {
+        m_thread.join();
+        m_sink.reset();
+    }
+}
+
+bool sclx_sound::play(const std::string& name) {
+    auto it = m_samples.find(name);
+    if (it == m_samples.end()) {
+        return false;
+    }
+    sample_t* sample = it->second.get();
+    std::int64_t now = now_ms();
+    std::int64_t last = sample->last_start_ms;
+    if (now - last < RETRIGGER_MS || !sample->last_start_ms.compare_exchange_strong(last, now)) {
+        return false;
+    }
+    // a voice keeps its sample in pending while it plays
+    std::size_t instances = 0;
+    for (auto& voice : m_voices) {
+        if (voice.pending.load(std::memory_order_relaxed) == sample) {
+            instances++;
+        }
+    }
+    if (instances >= MAX_INSTANCES) {
+        m_dropped++;
+        return false;
+    }
+    for (auto& voice : m_voices) {
+        const sample_t* expected = nullptr;
+        if (voice.pending.compare_exchange_strong(expected, sample, std::memory_order_acq_rel)) {
+            m_played++;
+            return true;
+        }
+    }
+    m_dropped++;
+    return false;
+}
+
+void sclx_sound::mix(std::int16_t* out, std::size_t frames) {
+    std::int32_t acc[PERIOD * CHANNELS];
+    while (frames > 0) {
+        std::size_t n = frames < PERIOD ? frames : PERIOD;
+        std::size_t samples = n * CHANNELS;
+        std::memset(acc, 0, samples * sizeof(std::int32_t));
+        for (auto& voice : m_voices) {
+            if (nullptr == voice.current) {
+                voice.current = voice.pending.load(std::memory_order_acquire);
+                voice.pos = 0;
+                if (nullptr == voice.current) {
+                    continue;
+                }
+            }
+            std::size_t count = std::min(samples, voice.current->frames * CHANNELS - voice.pos);
+            const std::int16_t* pcm = voice.current->pcm.data() + voice.pos;
+            for (std::size_t i = 0; i < count; i++) {
+                acc[i] += pcm[i];
+            }
+            voice.pos += count;
+            if (voice.pos >= voice.current->frames * CHANNELS) {
+                // free the voice
+                voice.current = nullptr;
+                voice.pending.store(nullptr, std::memory_order_release);
+            }
+        }
+        for (std::size_t i = 0; i < samples; i++) {
+            out[i] = static_cast<std::int16_t>(std::max(-32768, std::min(32767, acc[i])));
+        }
+        out += samples;
+        frames -= n;
+    }
+}
+
+void sclx_sound::run() {
+    std::int16_t buf[PERIOD * CHANNELS];
+    while (m_running) {
+        mix(buf, PERIOD);
+        if (!m_sink->write(buf, PERIOD)) {
+            terr("sclx_sound: output failed, no more sounds" << std::endl);
+            break;
+        }
+    }
+}
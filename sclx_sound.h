@@ -0,0 +1,91 @@
+#ifndef SCLX_SOUND_H_
+#define SCLX_SOUND_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Sound output for the race events. The wav files are decoded into 16 bit stereo PCM at the engine rate when they
+// are loaded, so play() only claims a voice. The engine thread mixes the active voices period by period and hands
+// them to a sink: ALSA (if compiled with SCLX_ALSA), a wav file or nothing.
+class sclx_sound {
+  public:
+    static constexpr unsigned RATE = 44100;
+    static constexpr unsigned CHANNELS = 2;
+    // frames per mix, 5.8ms
+    static constexpr std::size_t PERIOD = 256;
+    static constexpr std::size_t MAX_VOICES = 8;
+    // a sample plays at most this often at the same time
+    static constexpr std::size_t MAX_INSTANCES = 2;
+    // every web client asks for the sound of an event, so requests for a sample that started less than this ago
+    // are dropped
+    static constexpr std::int64_t RETRIGGER_MS = 250;
+
+    class sink {
+      public:
+        virtual ~sink() {}
+        // blocks until the device takes the frames, false on an unrecoverable error
+        virtual bool write(const std::int16_t* frames, std::size_t count) = 0;
+        // periods the device ran dry
+        virtual std::uint64_t underruns() const { return 0; }
+    };
+
+    // "alsa" or "alsa:<device>", "file:<path>" to record a wav file, "null" to discard, both in real time. Throws
+    // tasks::tasks_exception if the sink can not be opened.
+    static std::unique_ptr<sink> make_sink(const std::string& spec);
+
+    sclx_sound() : m_running(false), m_played(0), m_dropped(0) {}
+    ~sclx_sound() { stop(); }
+
+    // decode a wav file and register it as name, throws tasks::tasks_exception. Samples have to be loaded before
+    // start().
+    void load(const std::string& name, const std::string& path);
+    // load all wav files of dir as <prefix><file name>, returns the number of files
+    std::size_t load_dir(const std::string& dir, const std::string& prefix);
+
+    void start(std::unique_ptr<sink> out);
+    void stop();
+
+    // start a sample, lock free and callable from any thread. Returns false for an unknown or retriggered sample,
+    // if the sample plays MAX_INSTANCES times already or if all voices are busy.
+    bool play(const std::string& name);
+
+    // mix the next frames of all voices, called by the engine thread
+    void mix(std::int16_t* out, std::size_t frames);
+
+    inline std::uint64_t played() const { return m_played; }
+    inline std::uint64_t dropped() const { return m_dropped; }
+    inline std::uint64_t underruns() const { return m_sink ? m_sink->underruns() : 0; }
+    // bytes of decoded PCM
+    std::size_t memory() const;
+
+  private:
+    struct sample_t {
+        std::vector<std::int16_t> pcm;  // interleaved stereo
+        std::size_t frames = 0;
+        std::atomic<std::int64_t> last_start_ms{-RETRIGGER_MS};
+    };
+
+    // a voice is free while pending is null, current and pos belong to the engine thread
+    struct voice_t {
+        std::atomic<const sample_t*> pending{nullptr};
+        const sample_t* current = nullptr;
+        std::size_t pos = 0;
+    };
+
+    std::unordered_map<std::string, std::unique_ptr<sample_t>> m_samples;
+    voice_t m_voices[MAX_VOICES];
+    std::unique_ptr<sink> m_sink;
+    std::thread m_thread;
+    std::atomic<bool> m_running;
+    std::atomic<std::uint64_t> m_played;
+    std::atomic<std::uint64_t> m_dropped;
+
+    void run();
+};
+
+#endif  // SCLX_SOUND_H_
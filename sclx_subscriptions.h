@@ -0,0 +1,107 @@
+#ifndef SCLX_SUBSCRIPTIONS_H_
+#define SCLX_SUBSCRIPTIONS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// topics of the websocket broadcasts
+struct sclx_topic {
+    enum topic_t : std::uint8_t { RACE, POSITIONS, HANDSETS, SETTINGS, NUM_TOPICS };
+
+    // what a client gets that never subscribed, everything the web ui needs
+    static constexpr std::uint32_t DEFAULT_TOPICS = 1 << RACE | 1 << POSITIONS | 1 << SETTINGS;
+
+    static const char* to_string(topic_t topic) {
+        static const char* const names[NUM_TOPICS] = {"race", "positions", "handsets", "settings"};
+        return names[topic];
+    }
+
+    // NUM_TOPICS for an unknown name
+    static topic_t from_string(const std::string& name) {
+        for (int t = 0; t < NUM_TOPICS; t++) {
+            if (name == to_string(static_cast<topic_t>(t))) {
+                return static_cast<topic_t>(t);
+            }
+        }
+        return NUM_TOPICS;
+    }
+};
+
+// Topic subscriptions of the websocket clients. Every topic has a precomputed list of its subscribers, the lists are
+// rebuilt when a client subscribes or goes away and published as immutable snapshots, so a broadcast takes no lock.
+template <typename conn_ptr_t>
+class sclx_subscriptions {
+  public:
+    struct subscriber_t {
+        conn_ptr_t conn;
+        std::uint32_t topics;
+        std::uint8_t lanes;  // lane mask for the events of a single lane
+        std::uint32_t positions_interval_ms;
+        std::atomic<std::int64_t> positions_next_ms;  // steady clock
+    };
+    using list_t = std::vector<std::shared_ptr<subscriber_t>>;
+
+    sclx_subscriptions() {
+        for (auto& list : m_lists) {
+            list = std::make_shared<const list_t>();
+        }
+    }
+
+    // replaces the current subscription of the connection
+    void subscribe(const conn_ptr_t& conn, std::uint32_t topics, std::uint8_t lanes, std::uint32_t interval_ms) {
+        auto sub = std::make_shared<subscriber_t>();
+        sub->conn = conn;
+        sub->topics = topics;
+        sub->lanes = lanes;
+        sub->positions_interval_ms = interval_ms;
+        sub->positions_next_ms = 0;
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_subscribers[conn] = sub;
+        rebuild();
+    }
+
+    void unsubscribe(const conn_ptr_t& conn) {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_subscribers.erase(conn) > 0) {
+            rebuild();
+        }
+    }
+
+    inline std::shared_ptr<const list_t> subscribers(sclx_topic::topic_t topic) const {
+        return std::atomic_load(&m_lists[topic]);
+    }
+
+    // the shortest position update interval of all subscribers, 0 without subscribers
+    inline std::uint32_t positions_interval() const { return m_positions_interval; }
+
+  private:
+    std::mutex m_mtx;
+    std::map<conn_ptr_t, std::shared_ptr<subscriber_t>> m_subscribers;
+    std::shared_ptr<const list_t> m_lists[sclx_topic::NUM_TOPICS];
+    std::atomic<std::uint32_t> m_positions_interval{0};
+
+    // m_mtx has to be locked
+    void rebuild() {
+        std::uint32_t interval = 0;
+        for (int t = 0; t < sclx_topic::NUM_TOPICS; t++) {
+            auto list = std::make_shared<list_t>();
+            for (auto& s : m_subscribers) {
+                if (s.second->topics & (1 << t)) {
+                    list->push_back(s.second);
+                    if (sclx_topic::POSITIONS == t && (0 == interval || s.second->positions_interval_ms < interval)) {
+                        interval = s.second->positions_interval_ms;
+                    }
+                }
+            }
+            std::atomic_store(&m_lists[t], std::shared_ptr<const list_t>(std::move(list)));
+        }
+        m_positions_interval = interval;
+    }
+};
+
+#endif  // SCLX_SUBSCRIPTIONS_H_
@@ -1,4 +1,6 @@
 #include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <cstring>
 #include <sstream>
 #include <thread>
@@ -12,44 +14,61 @@
 
 #include "sclx_task.h"
 #include "sclx_consts.h"
+#include "sclx_lanes.h"
+#include "sclx_log.h"
+#include "sclx_trace.h"
 
 #define in_cur m_in[m_in_cur]
 #define in_last m_in[m_in_last]
 
+namespace {
+
+// the task that is handling a powerbase packet on this thread
+thread_local sclx_task* cycle_task = nullptr;
+
+// binding shows the car id for this long
+constexpr std::uint64_t BIND_TIME_US = 3000000;
+// a drive packet and the powerbase answer at 19200 baud, until the cycle time was measured
+constexpr std::uint64_t NOMINAL_CYCLE_US = 12500;
+
+inline std::uint64_t steady_us(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(t.time_since_epoch()).count();
+}
+
+}  // namespace
+
 sclx_task::sclx_task(std::string port)
-    : serial_io_task(EV_WRITE),
-      m_port(port),
+    : io_task(-1, EV_WRITE),
+      m_transport(sclx_transport::create(port)),
       m_last_update(std::chrono::steady_clock::now()),
       m_game_reset(false),
-      m_game_start(false),
-      m_update_car_mode(false) {
+      m_game_start(false) {
 
-    init_term();
+    init_transport();
 
-    // default power rate is 100%
-    for (std::uint8_t i = 0; i < 6; i++) {
+    // default power rate is 100% with a linear throttle
+    for (std::uint8_t i = 0; i < sclx::LANES; i++) {
         m_cars[i].id = i;
         m_cars[i].power_rate = 100;
+        m_cars[i].throttle_curve = throttle_curve_t::LINEAR;
+        m_cars[i].power_map_front = 0;
+        m_cars[i].power_map_back = 1;
+        m_cars[i].power_map_middle = 2;
+        update_power_map(i);
+        m_virtual[i] = 0;
     }
     reset_game_data();
-    m_game.reset = 1;
+    schedule_start_lights();
     m_game.state = game_state_t::TRAINING;
 }
 
-void sclx_task::init_term() {
-    term().open(m_port, B19200, tasks::serial::termmode_t::_8N1);
-
-    // update term settings
-    struct termios opts = term().options();
-    opts.c_iflag &= ~(IGNBRK | BRKINT | ICRNL | INLCR | PARMRK | INPCK | ISTRIP | IXON);
-    opts.c_lflag &= ~(ECHO | ECHONL | ICANON | IEXTEN | ISIG);
-    opts.c_oflag = 0;
-    opts.c_cc[VTIME] = 0;
-    opts.c_cc[VMIN] = in_cur.size();
-    term().set_options(opts);
+void sclx_task::init_transport() {
+    m_transport->open();
+    set_fd(m_transport->fd());
 }
 
 bool sclx_task::handle_event(tasks::worker* worker, int events) {
+    SCLX_TRACE_SCOPE("sclx_task::handle_event");
     bool success = true;
     try {
         if (EV_READ & events) {
@@ -57,16 +76,22 @@ bool sclx_task::handle_event(tasks::worker* worker, int events) {
                 terr("powerbase connected" << std::endl);
                 m_powerbase_connected = true;
                 reset_game_data();
-                m_game.reset = 1;
+                schedule_start_lights();
                 m_game.state = game_state_t::TRAINING;
             }
-            in_cur.read(term());
+            in_cur.read(*m_transport);
             if (in_cur.done()) {
                 // Switch the incoming packets
                 if (in_cur.valid()) {
                     // New incoming packet
                     handle_data();
                     switch_in_packets();
+                } else {
+                    m_stats.crc_errors++;
+                    // keeps the lap recording and the ghost car in step with the powerbase
+                    m_lost_cycles++;
+                    // a stream that lost a byte (bridge reconnects, dropped bytes) starts with the next frame again
+                    m_transport->discard_input();
                 }
                 in_cur.reset();
                 // Toggle to write mode
@@ -74,39 +99,16 @@ bool sclx_task::handle_event(tasks::worker* worker, int events) {
                 update_watcher(worker);
             }
         } else if (EV_WRITE & events) {
-            if (m_game.reset == 1) {
-                m_out.packet().led_status |= sclx::LED_GREEN | sclx::LED_RED;
-                m_game.reset++;
-            } else if (m_game.reset == 2) {
-                m_out.packet().led_status |= sclx::LED_GREEN;
-                m_out.packet().led_status &= ~sclx::LED_RED;
-                m_game.reset = 0;
-                m_post_next_game_update = 0;
-                if (m_game.state == game_state_t::STARTING) {
-                    set_game_state(game_state_t::RACE);
-                }
-            } else if (m_update_car_mode) {
-                // Send out an AUX packet to switch between analog/digital mode
-                m_out.packet().op_mode = sclx::OP_AUX;
-                m_out.packet().led_status = 0xff;
-                if (m_digital_car_mode) {
-                    m_out.packet().led_status &= ~sclx::PB_ANALOG_DIGITAL;
-                }
-                m_update_car_mode = false;
-            } else {
-                // if a game is running, turn on the red led
-                if (m_game.state == game_state_t::RACE) {
-                    m_out.packet().led_status |= sclx::LED_RED;
-                    m_out.packet().led_status &= ~sclx::LED_GREEN;
-                }
+            // a partial write (sockets) continues the packet
+            if (!m_out.started()) {
+                compose_packet();
             }
-            m_out.write(term());
+            m_out.write(*m_transport);
             if (m_out.done()) {
                 // Done writing the packet
                 m_out.reset();
-                // Restore drive state
-                if (m_out.packet().op_mode != sclx::OP_DRIVE) {
-                    m_out.packet().op_mode = sclx::OP_DRIVE;
+                if ((m_latency_pending || m_virtual_pending) && m_out.packet().op_mode == sclx::OP_DRIVE) {
+                    record_latency();
                 }
                 // Toggle to read mode
                 set_events(EV_READ);
@@ -121,21 +123,27 @@ bool sclx_task::handle_event(tasks::worker* worker, int events) {
 }
 
 void sclx_task::handle_data() {
-    m_last_update = std::chrono::steady_clock::now();
+    SCLX_TRACE_SCOPE("sclx_task::handle_data");
+    auto now = std::chrono::steady_clock::now();
+    update_cycle_stats(now);
+    m_last_update = now;
 
     if (!in_last.done()) {
         return;
     }
 
-    if (m_game.state == game_state_t::BINDING) {
-        auto dif = std::chrono::duration_cast<std::chrono::seconds>(m_last_update - m_bind_start).count();
-        if (dif < 3) {
-            m_out.packet().led_status = sclx::LED_RED | (1 << m_bind_id);
-        } else {
-            set_game_state(game_state_t::TRAINING);
-            m_game.reset = 1;
+    // collect the events of this cycle and post them together when the cycle is done
+    struct cycle_guard {
+        sclx_task* task;
+        explicit cycle_guard(sclx_task* t) : task(t) { cycle_task = t; }
+        ~cycle_guard() {
+            cycle_task = nullptr;
+            task->post_cycle_events();
         }
-    } else {
+    } guard(this);
+
+    // while binding a car the LEDs belong to the binding sequence
+    if (m_game.state != game_state_t::BINDING) {
         // always actiavte the LED for connected handsets
         update_leds();
         // check for handset updates
@@ -147,12 +155,83 @@ void sclx_task::handle_data() {
     }
 
     if (in_last.packet().aux_current != in_cur.packet().aux_current) {
-        terr("aux_current changed" << std::endl);
+        SCLX_LOG(AUX_CURRENT, in_cur.packet().aux_current);
+    }
+    m_lost_cycles = 0;
+}
+
+void sclx_task::update_cycle_stats(std::chrono::steady_clock::time_point now) {
+    std::int64_t cycle_us = std::chrono::duration_cast<std::chrono::microseconds>(now - m_last_update).count();
+    m_stats.cycles.fetch_add(1, std::memory_order_relaxed);
+    m_stats.cycle_time_us.fetch_add(cycle_us, std::memory_order_relaxed);
+    // running mean and mean deviation with a gain of 1/16 (like the RTP jitter estimate)
+    if (m_cycle_mean_us == 0) {
+        m_cycle_mean_us = cycle_us;
+    }
+    m_cycle_mean_us += (cycle_us - m_cycle_mean_us) / 16;
+    std::int64_t jitter = m_stats.cycle_jitter_us.load(std::memory_order_relaxed);
+    jitter += (std::abs(cycle_us - m_cycle_mean_us) - jitter) / 16;
+    m_stats.cycle_jitter_us.store(jitter, std::memory_order_relaxed);
+}
+
+void sclx_task::record_latency() {
+    auto now = std::chrono::steady_clock::now();
+    std::uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(now - m_latency_start).count();
+    for (std::uint8_t mask = m_latency_pending; mask; mask &= mask - 1) {
+        m_latency[sclx_lanes::first(mask)].record(us);
+    }
+    m_latency_pending = 0;
+    std::uint64_t now_us = steady_us(now) & VIRTUAL_TIME_MASK;
+    for (std::uint8_t mask = m_virtual_pending; mask; mask &= mask - 1) {
+        int i = sclx_lanes::first(mask);
+        m_virtual_latency[i].record(now_us - m_virtual_start[i]);
+    }
+    m_virtual_pending = 0;
+}
+
+void sclx_task::reset_latency() {
+    for (auto& h : m_latency) {
+        h.reset();
+    }
+    for (auto& h : m_virtual_latency) {
+        h.reset();
+    }
+}
+
+void sclx_task::exec(std::function<void()> f, bool batch) {
+    if (batch && cycle_task == this) {
+        m_cycle_events.push_back(std::move(f));
+        return;
+    }
+    m_stats.exec_queue++;
+    auto posted = SCLX_TRACE_NOW();
+    tasks::exec([this, f, posted] {
+        SCLX_TRACE_SPAN("sclx_task::exec_hop", posted);
+        {
+            SCLX_TRACE_SCOPE("sclx_task::exec");
+            f();
+        }
+        m_stats.exec_queue--;
+    });
+}
+
+void sclx_task::post_cycle_events() {
+    if (m_cycle_events.empty()) {
+        return;
     }
+    auto events = std::make_shared<std::vector<std::function<void()>>>(std::move(m_cycle_events));
+    m_cycle_events.clear();
+    exec([this, events] {
+        m_on_batch_func([&events] {
+            for (auto& f : *events) {
+                f();
+            }
+        });
+    });
 }
 
 void sclx_task::reset_car_data() {
-    for (int i = 0; i < 6; i++) {
+    for (int i = 0; i < sclx::LANES; i++) {
         m_cars[i].finished = false;
         m_cars[i].game_time = 0;
         m_cars[i].best_lap_time = 0;
@@ -165,7 +244,7 @@ void sclx_task::reset_game_data() {
     m_game.game_time = 0;
     m_game.finished_cars = 0;
     if (m_game.positions.empty()) {
-        for (std::uint8_t i = 0; i < 6; i++) {
+        for (std::uint8_t i = 0; i < sclx::LANES; i++) {
             car_ref_t carref = {i, m_cars};
             m_game.positions.push_back(carref);
         }
@@ -177,30 +256,42 @@ void sclx_task::reset_game_data() {
 void sclx_task::activate_cars(std::vector<std::uint8_t>& carids) {
     for (auto id : carids) {
         m_cars[id].active = true;
+        m_active_lanes |= 1 << id;
     }
 }
 
 void sclx_task::deactivate_cars() {
-    for (std::uint8_t i = 0; i < 6; i++) {
+    for (std::uint8_t i = 0; i < sclx::LANES; i++) {
         m_cars[i].active = false;
     }
+    m_active_lanes = 0;
 }
 
 void sclx_task::set_game_state(game_state_t state) {
     if (m_game.state != state) {
+        if (m_game.state == game_state_t::BINDING) {
+            // binding got interrupted
+            schedule(sclx_out_schedule::sequence(PRIO_BINDING, sclx_out_schedule::BINDING, {}));
+        }
         // new state
         m_game.state = state;
         // any actions
         switch (state) {
             case game_state_t::STOPPED:
-                for (int i = 0; i < 6; i++) {
-                    set_power(i, 0);
+                for (int i = 0; i < sclx::LANES; i++) {
+                    // no power under every throttle curve, the power tables belong to the serial thread
+                    set_drive_power(i, 0);
                     set_lane_change(i, false);
                 }
                 break;
             case game_state_t::RACE:
                 break;
             case game_state_t::COUNTDOWN:
+                // new race, new latency data and reaction times
+                reset_latency();
+                reset_game_data();
+                m_reaction_arm.store(true, std::memory_order_release);
+                break;
             case game_state_t::STARTING:
             case game_state_t::TRAINING:
             case game_state_t::BINDING:
@@ -208,17 +299,18 @@ void sclx_task::set_game_state(game_state_t state) {
                 break;
         }
         // inform handler
-        tasks::exec([this, state] { m_on_state_func(state); });
+        exec([this, state] { m_on_state_func(state); });
     }
 }
 
 void sclx_task::cycle_reset(tasks::worker* worker) {
+    m_stats.cycle_resets++;
     if (m_powerbase_connected) {
         terr("powerbase disconnected" << std::endl);
         m_powerbase_connected = false;
     }
-    term().close();
-    init_term();
+    m_transport->close();
+    init_transport();
     in_cur.reset();
     m_out.reset();
     set_events(EV_WRITE);
@@ -227,7 +319,7 @@ void sclx_task::cycle_reset(tasks::worker* worker) {
 }
 
 void sclx_task::set_drive_data(std::uint8_t carid, bool enable, std::uint8_t bit) {
-    if (carid < 6) {
+    if (carid < sclx::LANES) {
         std::uint8_t drive = ~m_out.packet().drive[carid];
         if (enable) {
             drive |= bit;
@@ -249,17 +341,24 @@ void sclx_task::set_lane_change(std::uint8_t carid, bool enable) {
     set_drive_data(carid, enable, sclx::LANE_CHANGE);
 }
 
+void sclx_task::set_drive_power(std::uint8_t carid, std::uint8_t power) {
+    std::uint8_t drive = ~m_out.packet().drive[carid];
+    drive &= ~sclx::POWER;
+    drive += power;
+    m_out.packet().drive[carid] = ~drive;
+}
+
 void sclx_task::set_power(std::uint8_t carid, std::uint8_t power) {
-    if (carid < 6) {
+    if (carid < sclx::LANES) {
         if (power <= sclx::POWER) {
-            if (m_cars[carid].power_rate < 100) {
-                // reduce power
-                power = power * m_cars[carid].power_rate / 100;
+            car_data_t& car = m_cars[carid];
+            // take the latest table, the old front one becomes the middle one
+            if (car.power_map_middle.load(std::memory_order_relaxed) & POWER_MAP_NEW) {
+                car.power_map_front =
+                    car.power_map_middle.exchange(car.power_map_front, std::memory_order_acq_rel) & ~POWER_MAP_NEW;
             }
-            std::uint8_t drive = ~m_out.packet().drive[carid];
-            drive &= ~sclx::POWER;
-            drive += power;
-            m_out.packet().drive[carid] = ~drive;
+            // apply the throttle curve and power rate
+            set_drive_power(carid, car.power_maps[car.power_map_front][power]);
         } else {
             throw tasks::tasks_exception(tasks::tasks_error::UNSET, std::string("set_power: invalid power value ") +
                                                                         std::to_string(static_cast<int>(power)));
@@ -271,8 +370,10 @@ void sclx_task::set_power(std::uint8_t carid, std::uint8_t power) {
 }
 
 void sclx_task::set_power_rate(std::uint8_t carid, std::uint8_t percentage) {
-    if (carid < 6 && percentage > 0 && percentage <= 100) {
+    if (carid < sclx::LANES && percentage > 0 && percentage <= 100) {
+        std::lock_guard<std::mutex> lock(m_mtx_power_maps);
         m_cars[carid].power_rate = percentage;
+        update_power_map(carid);
     } else {
         throw tasks::tasks_exception(tasks::tasks_error::UNSET, "set_power_rate: invalid input data: carid=" +
                                                                     std::to_string((int)carid) + " percentage=" +
@@ -280,104 +381,378 @@ void sclx_task::set_power_rate(std::uint8_t carid, std::uint8_t percentage) {
     }
 }
 
+void sclx_task::set_throttle_curve(std::uint8_t carid, throttle_curve_t curve) {
+    if (carid < sclx::LANES) {
+        std::lock_guard<std::mutex> lock(m_mtx_power_maps);
+        m_cars[carid].throttle_curve = curve;
+        update_power_map(carid);
+    } else {
+        throw tasks::tasks_exception(tasks::tasks_error::UNSET, std::string("set_throttle_curve: invalid carid ") +
+                                                                    std::to_string(static_cast<int>(carid)));
+    }
+}
+
+void sclx_task::update_power_map(std::uint8_t carid) {
+    car_data_t& car = m_cars[carid];
+    // the back table is ours, the serial thread never reads it
+    std::uint8_t* map = car.power_maps[car.power_map_back];
+    for (int i = 0; i <= sclx::POWER; i++) {
+        if (car.throttle_curve == throttle_curve_t::LINEAR) {
+            // same integer math as the old linear cap
+            map[i] = i * car.power_rate / 100;
+            continue;
+        }
+        double x = static_cast<double>(i) / sclx::POWER;
+        double y = x;
+        switch (car.throttle_curve) {
+            case throttle_curve_t::EXPONENTIAL:
+                // fine control at low speed, full power at the end
+                y = (std::exp(3. * x) - 1.) / (std::exp(3.) - 1.);
+                break;
+            case throttle_curve_t::S_CURVE:
+                y = x * x * (3. - 2. * x);
+                break;
+            case throttle_curve_t::DEADBAND:
+                // ignore the first 10% of the trigger
+                y = x < .1 ? 0. : (x - .1) / .9;
+                break;
+            case throttle_curve_t::LINEAR:
+                break;
+        }
+        map[i] = static_cast<std::uint8_t>(std::lround(y * sclx::POWER * car.power_rate / 100.));
+    }
+    car.power_map_back =
+        car.power_map_middle.exchange(car.power_map_back | POWER_MAP_NEW, std::memory_order_acq_rel) & ~POWER_MAP_NEW;
+}
+
+void sclx_task::set_virtual_handset(std::uint8_t carid, std::uint8_t power, bool brake, bool lane_change) {
+    if (carid < sclx::LANES && power <= sclx::POWER) {
+        std::uint64_t handset = power | (brake ? sclx::BRAKE : 0) | (lane_change ? sclx::LANE_CHANGE : 0);
+        std::uint64_t now = steady_us(std::chrono::steady_clock::now()) & VIRTUAL_TIME_MASK;
+        m_virtual[carid].store(VIRTUAL_ACTIVE | now << 8 | handset, std::memory_order_release);
+        m_virtual_active.fetch_or(1 << carid, std::memory_order_release);
+    } else {
+        throw tasks::tasks_exception(tasks::tasks_error::UNSET, "set_virtual_handset: invalid input data: carid=" +
+                                                                    std::to_string((int)carid) + " power=" +
+                                                                    std::to_string((int)power));
+    }
+}
+
+void sclx_task::release_virtual_handset(std::uint8_t carid) {
+    if (carid < sclx::LANES) {
+        m_virtual_active.fetch_and(~(1 << carid), std::memory_order_release);
+        m_virtual[carid].store(0, std::memory_order_release);
+    } else {
+        throw tasks::tasks_exception(tasks::tasks_error::UNSET, std::string("release_virtual_handset: invalid carid ") +
+                                                                    std::to_string(static_cast<int>(carid)));
+    }
+}
+
+void sclx_task::start_ghost(std::uint8_t carid, const sclx_ghost::lap_t& lap) {
+    if (carid < sclx::LANES && lap.cycles > 0) {
+        // expand the lap here, the serial thread only takes the player over
+        delete m_ghost_next.exchange(new sclx_ghost::player(carid, lap), std::memory_order_acq_rel);
+    } else {
+        throw tasks::tasks_exception(tasks::tasks_error::UNSET, "start_ghost: invalid input data: carid=" +
+                                                                    std::to_string((int)carid) + " cycles=" +
+                                                                    std::to_string(lap.cycles));
+    }
+}
+
+void sclx_task::stop_ghost() {
+    delete m_ghost_next.exchange(new sclx_ghost::player(), std::memory_order_acq_rel);
+}
+
+// Lanes driven by a virtual handset get its state instead of the handset byte of the powerbase. The last packet gets
+// the state applied in the last cycle, so the change detection works as for a real handset, also when a lane
+// switches between a virtual and a physical handset. Returns the lanes with a virtual handset.
+std::uint8_t sclx_task::apply_virtual_handsets(std::uint64_t& cur, std::uint64_t& last) {
+    std::uint8_t active = m_virtual_active.load(std::memory_order_acquire) & ~m_ctrl_connected;
+    if (!active && !m_virtual_lanes) {
+        return 0;
+    }
+    last = (last & ~sclx_lanes::bytes(m_virtual_lanes)) | m_virtual_word;
+    std::uint64_t now = steady_us(m_last_update) & VIRTUAL_TIME_MASK;
+    std::uint64_t timeout = m_virtual_timeout_us.load(std::memory_order_relaxed);
+    std::uint64_t word = 0;
+    for (std::uint8_t mask = active; mask; mask &= mask - 1) {
+        int i = sclx_lanes::first(mask);
+        std::uint8_t bit = 1 << i;
+        std::uint64_t slot = m_virtual[i].load(std::memory_order_acquire);
+        std::uint64_t stamp = (slot >> 8) & VIRTUAL_TIME_MASK;
+        std::uint8_t handset;
+        // a state stored after the start of this cycle is newer than now
+        if (!(slot & VIRTUAL_ACTIVE) || (now > stamp && now - stamp > timeout)) {
+            // the client went silent, stop the car
+            handset = sclx::BRAKE;
+            if (!(m_virtual_stale & bit)) {
+                m_virtual_stale |= bit;
+                m_stats.virtual_stale.fetch_add(1, std::memory_order_relaxed);
+                SCLX_LOG(VIRTUAL_STALE, i, now - stamp);
+            }
+        } else {
+            handset = static_cast<std::uint8_t>(slot);
+            m_virtual_stale &= ~bit;
+            // time a new state until the drive packet is out
+            if (!(m_virtual_pending & bit) &&
+                (!(m_virtual_lanes & bit) || handset != sclx_lanes::handset(m_virtual_word, i))) {
+                m_virtual_start[i] = stamp;
+                m_virtual_pending |= bit;
+            }
+        }
+        word |= static_cast<std::uint64_t>(handset) << (8 * i);
+    }
+    cur = (cur & ~sclx_lanes::bytes(active)) | word;
+    m_virtual_stale &= active;
+    m_virtual_lanes = active;
+    m_virtual_word = word;
+    return active;
+}
+
+// The ghost car drives its lane like a virtual handset, with the same handling of the last packet. It holds still
+// until the race starts. Returns the lane of the ghost car as mask, 0 if a handset took the lane.
+std::uint8_t sclx_task::apply_ghost(std::uint64_t& cur, std::uint64_t& last, std::uint8_t taken) {
+    if (m_ghost_next.load(std::memory_order_relaxed)) {
+        m_ghost.reset(m_ghost_next.exchange(nullptr, std::memory_order_acq_rel));
+        if (m_ghost->empty()) {
+            m_ghost.reset();
+        }
+        m_ghost_lane = m_ghost ? m_ghost->carid() : sclx::LANES;
+    }
+    if (!m_ghost && !m_ghost_lanes) {
+        return 0;
+    }
+    last = (last & ~sclx_lanes::bytes(m_ghost_lanes)) | m_ghost_word;
+    std::uint8_t lane = 0;
+    std::uint64_t word = 0;
+    if (m_ghost && !(taken & (1 << m_ghost->carid()))) {
+        lane = 1 << m_ghost->carid();
+        std::uint8_t handset = 0;
+        if (m_game.state == game_state_t::RACE || m_game.state == game_state_t::TRAINING) {
+            handset = m_ghost->next(m_lost_cycles);
+        } else {
+            m_ghost->rewind();
+        }
+        word = static_cast<std::uint64_t>(handset) << (8 * m_ghost->carid());
+        cur = (cur & ~sclx_lanes::bytes(lane)) | word;
+    }
+    m_ghost_lanes = lane;
+    m_ghost_word = word;
+    return lane;
+}
+
+// add the handset bytes of this cycle to the laps of the lanes, lost packets repeat the byte
+void sclx_task::record_laps(std::uint64_t cur, std::uint8_t lanes) {
+    for (std::uint8_t mask = lanes; mask; mask &= mask - 1) {
+        int i = sclx_lanes::first(mask);
+        m_recorders[i].record(sclx_lanes::handset(cur, i), 1 + m_lost_cycles);
+    }
+}
+
+// Timestamp the first throttle of the cars with the race clock of the powerbase packet. Throttle before the green
+// light is a jump start, it gets reported when the race starts.
+void sclx_task::record_reactions(std::uint64_t cur, std::uint8_t changed) {
+    if (m_game.state != game_state_t::COUNTDOWN && m_game.state != game_state_t::STARTING &&
+        m_game.state != game_state_t::RACE) {
+        // the race got stopped
+        m_reaction_pending = 0;
+        return;
+    }
+    std::uint8_t pressed = 0;
+    for (std::uint8_t mask = changed & m_reaction_pending; mask; mask &= mask - 1) {
+        int i = sclx_lanes::first(mask);
+        if (sclx::POWER & sclx_lanes::handset(cur, i)) {
+            pressed |= 1 << i;
+        }
+    }
+    if (!pressed) {
+        return;
+    }
+    std::uint64_t time = race_clock(in_cur.packet());
+    for (std::uint8_t mask = pressed; mask; mask &= mask - 1) {
+        m_first_throttle[sclx_lanes::first(mask)] = time;
+    }
+    m_reaction_pending &= ~pressed;
+    if (m_game.state == game_state_t::RACE) {
+        post_reactions(pressed);
+    } else {
+        m_jump_start |= pressed;
+    }
+}
+
+void sclx_task::post_reactions(std::uint8_t lanes) {
+    for (std::uint8_t mask = lanes; mask; mask &= mask - 1) {
+        std::uint8_t carid = sclx_lanes::first(mask);
+        std::int64_t reaction_time = static_cast<std::int64_t>(m_first_throttle[carid] - m_start_time);
+        bool jump_start = m_jump_start & (1 << carid);
+        SCLX_LOG(REACTION, carid, reaction_time, jump_start);
+        exec([this, carid, reaction_time, jump_start] { m_on_reaction_func(carid, reaction_time, jump_start); });
+    }
+}
+
 void sclx_task::set_leds(std::uint8_t leds) {
-    m_out.packet().led_status = leds;
+    m_leds = leds;
 }
 
-void sclx_task::update_leds() {
-    std::uint8_t status = in_cur.packet().status;
-    std::uint8_t leds = 0;
-    bool connected = false;
-    if (sclx::HANDSET_1 & status) {
-        leds |= sclx::LED_1;
-        connected = true;
+void sclx_task::bind_car(std::uint8_t id) {
+    if (id >= sclx::LANES) {
+        throw tasks::tasks_exception(tasks::tasks_error::UNSET, std::string("bind_car: invalid carid ") +
+                                                                    std::to_string(static_cast<int>(id)));
     }
-    update_ctrl_connected(0, connected);
-    connected = false;
-    if (sclx::HANDSET_2 & status) {
-        leds |= sclx::LED_2;
-        connected = true;
+    set_game_state(game_state_t::STOPPED);
+    set_game_state(game_state_t::BINDING);
+    // 3 seconds at the measured cycle time
+    std::uint64_t cycles = m_stats.cycles.load(std::memory_order_relaxed);
+    std::uint64_t cycle_us = cycles > 0 ? m_stats.cycle_time_us.load(std::memory_order_relaxed) / cycles : 0;
+    std::uint64_t frames = BIND_TIME_US / (cycle_us > 0 ? cycle_us : NOMINAL_CYCLE_US);
+    std::uint8_t leds = sclx::LED_RED | (1 << id);
+    // reset the powerbase with the GREEN+RED -> GREEN frames of the start lights, then show the car id
+    schedule(sclx_out_schedule::sequence(
+        PRIO_BINDING, sclx_out_schedule::BINDING,
+        {sclx_out_schedule::leds(sclx::LED_GREEN | sclx::LED_RED, 0, 0),
+         sclx_out_schedule::leds(sclx::LED_GREEN, sclx::LED_RED, 1),
+         sclx_out_schedule::leds(leds, ~leds, 1, static_cast<std::uint16_t>(std::min<std::uint64_t>(frames, 0xffff))),
+         sclx_out_schedule::event(EVENT_BIND_DONE, 1)}));
+}
+
+void sclx_task::schedule(const sclx_out_schedule::sequence_t& seq) {
+    // a full queue or a slot with all cells busy refuses a sequence, it gets dropped and counted
+    if (!m_schedule.push(seq)) {
+        m_stats.schedule_dropped.fetch_add(1, std::memory_order_relaxed);
     }
-    update_ctrl_connected(1, connected);
-    connected = false;
-    if (sclx::HANDSET_3 & status) {
-        leds |= sclx::LED_3;
-        connected = true;
+}
+
+void sclx_task::schedule_start_lights() {
+    schedule(sclx_out_schedule::sequence(
+        PRIO_START_LIGHTS, sclx_out_schedule::START_LIGHTS,
+        {sclx_out_schedule::leds(sclx::LED_GREEN | sclx::LED_RED, 0, 0),
+         sclx_out_schedule::leds(sclx::LED_GREEN, sclx::LED_RED, 1),
+         sclx_out_schedule::event(EVENT_START_LIGHTS, 0)}));
+}
+
+void sclx_task::schedule_car_mode() {
+    // an AUX packet switches between analog/digital mode
+    std::uint8_t status = 0xff;
+    if (m_digital_car_mode) {
+        status &= ~sclx::PB_ANALOG_DIGITAL;
     }
-    update_ctrl_connected(2, connected);
-    connected = false;
-    if (sclx::HANDSET_4 & status) {
-        leds |= sclx::LED_4;
-        connected = true;
+    schedule(sclx_out_schedule::sequence(PRIO_CAR_MODE, sclx_out_schedule::CAR_MODE,
+                                         {sclx_out_schedule::aux(status, 0)}));
+}
+
+void sclx_task::compose_packet() {
+    std::uint8_t leds = m_leds;
+    // if a game is running, turn on the red led
+    if (m_game.state == game_state_t::RACE) {
+        leds |= sclx::LED_RED;
+        leds &= ~sclx::LED_GREEN;
     }
-    update_ctrl_connected(3, connected);
-    connected = false;
-    if (sclx::HANDSET_5 & status) {
-        leds |= sclx::LED_5;
-        connected = true;
+    std::uint32_t events = m_schedule.compose(m_out.packet(), leds);
+    if (events & (1u << EVENT_START_LIGHTS)) {
+        m_post_next_game_update = 0;
+        if (m_game.state == game_state_t::STARTING) {
+            // the green light goes out with this packet, the reaction times count from the last packet on the race
+            // clock. The powerbase restarts its clock now, the race clock carries on from there.
+            m_start_time = race_clock(in_last.packet());
+            set_game_state(game_state_t::RACE);
+            if (m_jump_start) {
+                post_reactions(m_jump_start);
+            }
+        }
     }
-    update_ctrl_connected(4, connected);
-    connected = false;
-    if (sclx::HANDSET_6 & status) {
-        leds |= sclx::LED_6;
-        connected = true;
+    if ((events & (1u << EVENT_BIND_DONE)) && m_game.state == game_state_t::BINDING) {
+        set_game_state(game_state_t::TRAINING);
+        schedule_start_lights();
     }
-    update_ctrl_connected(5, connected);
-    m_out.packet().led_status = leds;
 }
 
-void sclx_task::update_ctrl_connected(std::uint8_t id, bool connected) {
-    if (m_ctrl_connected[id] != connected) {
-        m_ctrl_connected[id] = connected;
-        m_on_controller_func(id, connected);
+void sclx_task::update_leds() {
+    SCLX_TRACE_SCOPE("sclx_task::update_leds");
+    std::uint8_t status = in_cur.packet().status;
+    std::uint8_t connected = sclx_lanes::connected(status);
+    m_leds = sclx_lanes::leds(status);
+    // controller changes are rare, only walk the lanes that flipped
+    for (std::uint8_t changed = connected ^ m_ctrl_connected; changed; changed &= changed - 1) {
+        std::uint8_t id = sclx_lanes::first(changed);
+        bool on = connected & (1 << id);
+        exec([this, id, on] { m_on_controller_func(id, on); });
     }
+    if (connected != m_ctrl_connected) {
+        m_physical_handsets.store(connected, std::memory_order_relaxed);
+    }
+    m_ctrl_connected = connected;
 }
 
 void sclx_task::update_handsets() {
+    SCLX_TRACE_SCOPE("sclx_task::update_handsets");
     if (m_game.state != game_state_t::STOPPED) {
-        for (int i = 0; i < 6; i++) {
-            // apply the power/brake/lane change settings from the handsets
-            if (m_game.state == game_state_t::TRAINING || (m_cars[i].active /*&& !m_cars[i].finished*/)) {
-                std::uint8_t cur = ~in_cur.packet().handset[i];
-                std::uint8_t last = ~in_last.packet().handset[i];
-                if (cur != last) {
-                    if ((sclx::BRAKE & cur) != (sclx::BRAKE & last)) {
-                        tdbg("handset" << i << ": brake " << (sclx::BRAKE & cur ? "on" : "off") << std::endl);
-                        set_brake(i, sclx::BRAKE & cur);
-                    }
-                    if ((sclx::LANE_CHANGE & cur) != (sclx::LANE_CHANGE & last)) {
-                        tdbg("handset" << i << ": lane change " << (sclx::LANE_CHANGE & cur ? "on" : "off")
-                                       << std::endl);
-                        set_lane_change(i, sclx::LANE_CHANGE & cur);
-                    }
-                    if ((sclx::POWER & cur) != (sclx::POWER & last)) {
-                        tdbg("handset" << i << ": power " << static_cast<int>(sclx::POWER & cur) << std::endl);
-                        set_power(i, sclx::POWER & cur);
-                    }
-                }
-            }/* else if (m_cars[i].active && m_cars[i].finished) {
-                std::uint8_t power = ~m_out.packet().drive[i] & sclx::POWER;
-                if (power > 0) {
-                    // after the finish line we want the car to go for some time
-                    std::uint64_t dif = m_game.game_time - m_cars[i].game_time;
-                    if (dif < 1500000) {
-                        set_power(i, 40);
-                    } else {
-                        set_power(i, 0);
-                    }
-                }
-            }*/
+        // apply the power/brake/lane change settings from the handsets
+        std::uint8_t lanes = m_active_lanes;
+        if (m_game.state == game_state_t::TRAINING) {
+            lanes = sclx_lanes::ALL;
+        }
+        std::uint64_t cur = sclx_lanes::load(in_cur.packet().handset);
+        std::uint64_t last = sclx_lanes::load(in_last.packet().handset);
+        std::uint8_t virtual_lanes = apply_virtual_handsets(cur, last);
+        std::uint8_t ghost_lane = apply_ghost(cur, last, m_ctrl_connected | virtual_lanes);
+        if (m_game.state == game_state_t::RACE || m_game.state == game_state_t::TRAINING) {
+            record_laps(cur, lanes & ~ghost_lane);
+        }
+        sclx_lanes::changes_t changes = sclx_lanes::changes(cur, last);
+        std::uint8_t throttle_changes = changes.power;
+        if (m_reaction_arm.load(std::memory_order_acquire)) {
+            // a new race, a throttle that is already held counts as well
+            m_reaction_arm = false;
+            m_reaction_pending = m_active_lanes;
+            m_jump_start = 0;
+            throttle_changes |= m_active_lanes;
+        }
+        if (in_cur.packet().game_time_sf < in_last.packet().game_time_sf) {
+            // the powerbase restarted its clock, keep the race clock going
+            m_clock_offset = race_clock(in_last.packet());
+        }
+        if (m_reaction_pending) {
+            record_reactions(cur, throttle_changes);
+        }
+        // time throttle and brake changes until the drive packet is out, virtual handsets are timed from the frame
+        std::uint8_t timed = (changes.brake | changes.power) & lanes & ~virtual_lanes & ~ghost_lane;
+        if (timed && !m_latency_pending) {
+            m_latency_start = m_last_update;
+        }
+        m_latency_pending |= timed;
+        for (std::uint8_t mask = changes.any & lanes; mask; mask &= mask - 1) {
+            int i = sclx_lanes::first(mask);
+            std::uint8_t bit = 1 << i;
+            std::uint8_t handset = sclx_lanes::handset(cur, i);
+            if (changes.brake & bit) {
+                SCLX_LOG_DBG(HANDSET_BRAKE, i, sclx::BRAKE & handset);
+                set_brake(i, sclx::BRAKE & handset);
+            }
+            if (changes.lane_change & bit) {
+                SCLX_LOG_DBG(HANDSET_LANE_CHANGE, i, sclx::LANE_CHANGE & handset);
+                set_lane_change(i, sclx::LANE_CHANGE & handset);
+            }
+            if (changes.power & bit) {
+                SCLX_LOG_DBG(HANDSET_POWER, i, sclx::POWER & handset);
+                set_power(i, sclx::POWER & handset);
+            }
+            if (m_handset_events) {
+                exec([this, i, handset] {
+                    m_on_handset_func(i, sclx::POWER & handset, sclx::BRAKE & handset, sclx::LANE_CHANGE & handset);
+                });
+            }
         }
     }
 }
 
 void sclx_task::update_game() {
+    SCLX_TRACE_SCOPE("sclx_task::update_game");
     std::uint8_t carid = (sclx::CARID_INVALID & in_cur.packet().carid_sf);  // just look at the last 3 bits
     std::uint64_t time = 6.4 * in_cur.packet().game_time_sf;
     if (in_last.packet().game_time_sf != in_cur.packet().game_time_sf) {
         // game timer
         m_game.game_time = time;
-        if (carid > 0 && carid < 7) {
+        if (carid > 0 && carid <= sclx::LANES) {
             carid--;  // we work with 0 based indexes
             if (m_game.state == game_state_t::RACE || m_game.state == game_state_t::TRAINING) {
                 // a car crossed the start/finish line
@@ -386,29 +761,46 @@ void sclx_task::update_game() {
                 // lap time
                 std::uint64_t lap_time = time - car.game_time;
                 car.game_time = time;
+                sclx_ghost::recorder& recorder = m_recorders[carid];
                 if (car.laps > 0) {
                     bool record = false;
                     if (car.best_lap_time == 0 || lap_time < car.best_lap_time) {
                         // new record
                         m_cars[carid].best_lap_time = lap_time;
                         record = true;
+                        std::uint32_t cycles = recorder.cycles();
+                        std::vector<sclx_ghost::run_t>* runs;
+                        if (recorder.valid() && cycles > 0 && nullptr != (runs = recorder.take())) {
+                            // the lap gets copied off the serial thread
+                            exec([this, carid, lap_time, cycles, runs, &recorder] {
+                                m_on_ghost_lap_func(carid, recorder.lap(runs, carid, lap_time, cycles));
+                            });
+                        }
                     }
                     std::uint8_t laps = car.laps;
-                    tasks::exec(
+                    exec(
                         [this, carid, laps, lap_time, record] { m_on_lap_func(carid, laps, lap_time, record); });
                 } else {
                     car.start_time = time;
                 }
+                // the next lap starts here, for the ghost car as well
+                recorder.restart();
+                if (m_ghost && m_ghost->carid() == carid) {
+                    m_ghost->rewind();
+                }
                 if (m_game.state == game_state_t::RACE && car.laps == m_game.laps) {
                     // finished
                     car.finished = true;
                     m_game.finished_cars++;
                     if (m_game.finished_cars == m_game.active_cars) {
-                        // all cars passed the finish line, game finished
-                        tasks::exec([this, time] {
-                            std::this_thread::sleep_for(std::chrono::seconds(2));
-                            post_game_update(true, time);
-                        });
+                        // all cars passed the finish line, game finished (not batched, it would hold up the other
+                        // events of this cycle)
+                        exec(
+                            [this, time] {
+                                std::this_thread::sleep_for(std::chrono::seconds(2));
+                                post_game_update(true, time);
+                            },
+                            false);
                     }
                 } else {
                     // next laps
@@ -416,34 +808,36 @@ void sclx_task::update_game() {
                 }
             } else if (m_game.state == game_state_t::STARTING || m_game.state == game_state_t::COUNTDOWN) {
                 // false start
-                tasks::exec([this, carid] { m_on_false_start_func(carid); });
+                exec([this, carid] { m_on_false_start_func(carid); });
                 set_game_state(game_state_t::STOPPED);
             }
         }
         if (time > m_post_next_game_update) {
-            // send a game update every second
-            tasks::exec([this, time] { post_game_update(false, time); });
-            m_post_next_game_update = time + 1000000;
+            // send a game update at the interval the clients asked for, every second by default
+            exec([this, time] { post_game_update(false, time); });
+            m_post_next_game_update = time + m_game_update_interval;
         }
     }
 }
 
 void sclx_task::update_buttons() {
+    SCLX_TRACE_SCOPE("sclx_task::update_buttons");
     if (in_last.packet().button_status != in_cur.packet().button_status) {
         std::uint8_t btn = ~in_cur.packet().button_status;
-        tdbg("update_buttons: btn=0x" << std::hex << static_cast<int>(btn) << std::dec << std::endl);
+        SCLX_LOG_DBG(BUTTONS, btn);
+        // not batched, the button handlers run the race countdown and block for several seconds
         if (sclx::BTN_START & btn) {
-            tasks::exec([this] { m_on_button_func(sclx::BTN_START); });
+            exec([this] { m_on_button_func(sclx::BTN_START); }, false);
         } else if (sclx::BTN_RIGHT & btn) {
-            tasks::exec([this] { m_on_button_func(sclx::BTN_RIGHT); });
+            exec([this] { m_on_button_func(sclx::BTN_RIGHT); }, false);
         } else if (sclx::BTN_UP & btn) {
-            tasks::exec([this] { m_on_button_func(sclx::BTN_UP); });
+            exec([this] { m_on_button_func(sclx::BTN_UP); }, false);
         } else if (sclx::BTN_ENTER & btn) {
-            tasks::exec([this] { m_on_button_func(sclx::BTN_ENTER); });
+            exec([this] { m_on_button_func(sclx::BTN_ENTER); }, false);
         } else if (sclx::BTN_LEFT & btn) {
-            tasks::exec([this] { m_on_button_func(sclx::BTN_LEFT); });
+            exec([this] { m_on_button_func(sclx::BTN_LEFT); }, false);
         } else if (sclx::BTN_DOWN & btn) {
-            tasks::exec([this] { m_on_button_func(sclx::BTN_DOWN); });
+            exec([this] { m_on_button_func(sclx::BTN_DOWN); }, false);
         }
     }
 }
@@ -1,48 +1,109 @@
 #ifndef SCLX_TASK_H_
 #define SCLX_TASK_H_
 
-#include <tasks/serial_io_task.h>
+#include <tasks/io_task.h>
 #include <tasks/worker.h>
 
 #include <chrono>
 #include <atomic>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <vector>
 
+#include "sclx_consts.h"
+#include "sclx_ghost.h"
+#include "sclx_histogram.h"
 #include "sclx_in.h"
 #include "sclx_out.h"
+#include "sclx_schedule.h"
+#include "sclx_transport.h"
 
-class sclx_task : public tasks::serial_io_task {
+class sclx_task : public tasks::io_task {
   public:
     enum class game_state_t : std::uint8_t { STOPPED, COUNTDOWN, RACE, STARTING, TRAINING, BINDING };
 
+    // throttle response of a handset, the power rate caps the output on top of the curve
+    enum class throttle_curve_t : std::uint8_t { LINEAR, EXPONENTIAL, S_CURVE, DEADBAND };
+
     // car gaming data
     struct car_data_t {
         std::uint8_t id;        
         bool active;
         bool finished;
-        std::uint8_t power_rate;        
+        std::uint8_t power_rate;
+        throttle_curve_t throttle_curve;
+        // Handset power to drive power, rebuilt when the curve or rate changes. A triple buffer: the serial thread
+        // reads the front table, update_power_map fills the back one and swaps it with the middle one, the serial
+        // thread swaps the front table with a new middle one before the next lookup.
+        std::uint8_t power_maps[3][sclx::POWER + 1];
+        std::uint8_t power_map_front;                 // serial thread
+        std::uint8_t power_map_back;                  // update_power_map, under m_mtx_power_maps
+        std::atomic<std::uint8_t> power_map_middle;   // POWER_MAP_NEW is set until the serial thread takes it
         std::uint64_t start_time;
         std::uint64_t game_time;
         std::uint32_t best_lap_time;
         std::uint8_t laps;
     };
 
+    // counters for monitoring, updated without locks on the hot paths
+    struct stats_t {
+        std::atomic<std::uint64_t> cycles{0};
+        std::atomic<std::uint64_t> cycle_time_us{0};    // sum of all cycle times
+        std::atomic<std::uint64_t> cycle_jitter_us{0};  // smoothed deviation from the mean cycle time
+        std::atomic<std::uint64_t> crc_errors{0};
+        std::atomic<std::uint64_t> cycle_resets{0};
+        std::atomic<std::int64_t> exec_queue{0};        // events handed to tasks::exec but not yet handled
+        std::atomic<std::uint64_t> virtual_stale{0};    // virtual handsets that went silent and got braked
+        std::atomic<std::uint64_t> schedule_dropped{0}; // sequences refused by the outbound frame scheduler
+    };
+
+    // port is a transport spec, see sclx_transport::create
     sclx_task(std::string port);
+    ~sclx_task() { delete m_ghost_next.exchange(nullptr); }
     bool handle_event(tasks::worker* worker, int events);
 
     void set_leds(std::uint8_t leds);
     void set_brake(std::uint8_t carid, bool enable);
     void set_lane_change(std::uint8_t carid, bool enable);
+    // handset power through the throttle curve, serial thread only as it takes over the new power tables
     void set_power(std::uint8_t carid, std::uint8_t power);
     void set_power_rate(std::uint8_t carid, std::uint8_t percentage);
+    void set_throttle_curve(std::uint8_t carid, throttle_curve_t curve);
+
+    // Virtual handsets drive lanes without a physical handset, e.g. from a phone. Any thread can store the state of
+    // a lane, lock free. The next powerbase cycle applies it like a handset packet, a physical handset on the lane
+    // takes precedence. A lane without a new state for the timeout gets the brake.
+    void set_virtual_handset(std::uint8_t carid, std::uint8_t power, bool brake, bool lane_change);
+    void release_virtual_handset(std::uint8_t carid);
+    inline bool virtual_handset(std::uint8_t carid) const {
+        return m_virtual_active.load(std::memory_order_relaxed) & (1 << carid);
+    }
+    // a physical handset is plugged into the lane, it overrides the virtual one
+    inline bool physical_handset(std::uint8_t carid) const {
+        return m_physical_handsets.load(std::memory_order_relaxed) & (1 << carid);
+    }
+    void set_virtual_handset_timeout(std::uint64_t us) {
+        m_virtual_timeout_us = us;
+    }
+
+    // Ghost car: replay a recorded lap on a lane without a handset. The playback waits for the green light (or starts
+    // right away in training) and starts over each time the ghost car crosses the line, so it keeps in step with the
+    // track. A physical or virtual handset on the lane takes precedence. Throws tasks::tasks_exception for an invalid
+    // carid or an empty lap.
+    void start_ghost(std::uint8_t carid, const sclx_ghost::lap_t& lap);
+    void stop_ghost();
+    // lane of the ghost car, sclx::LANES if there is none
+    inline std::uint8_t ghost_lane() const {
+        return m_ghost_lane.load(std::memory_order_relaxed);
+    }
 
     // if we don't get data for some time, the task gest reset
     void cycle_reset(tasks::worker* worker);
 
     void game_stop() {
         set_game_state(game_state_t::STOPPED);
-        m_game.reset = 1;
+        schedule_start_lights();
     }
     
     void game_init(uint8_t laps, std::vector<std::uint8_t> carids) {
@@ -55,27 +116,23 @@ class sclx_task : public tasks::serial_io_task {
         deactivate_cars();
         activate_cars(carids);
         set_game_state(game_state_t::COUNTDOWN);
-        m_game.reset = 1;
+        schedule_start_lights();
     }
 
     void game_start() {
         if (m_game.state == game_state_t::COUNTDOWN) {
             set_game_state(game_state_t::STARTING);
-            m_game.reset = 1;
+            schedule_start_lights();
         }
     }
 
-    void bind_car(std::uint8_t id) {
-        set_game_state(game_state_t::STOPPED);
-        set_game_state(game_state_t::BINDING);
-        m_game.reset = 1;
-        m_bind_id = id;
-        m_bind_start = std::chrono::steady_clock::now();
-    }
+    // Reset the powerbase like the start lights do, then show the car id on the LEDs for 3 seconds. The powerbase binds
+    // the car that is put on the track meanwhile.
+    void bind_car(std::uint8_t id);
 
     void training() {
         set_game_state(game_state_t::TRAINING);
-        m_game.reset = 1;
+        schedule_start_lights();
     }
 
     game_state_t game_state() {
@@ -86,10 +143,20 @@ class sclx_task : public tasks::serial_io_task {
         return m_digital_car_mode;
     }
 
+    // interval of the game updates (positions) during a race
+    void set_game_update_interval(std::uint64_t us) {
+        m_game_update_interval = us;
+    }
+
+    // raise handset events, only needed while a client wants the telemetry
+    void set_handset_events(bool enable) {
+        m_handset_events = enable;
+    }
+
     void set_digital_car_mode(bool digital = true) {
         if (digital != m_digital_car_mode) {
             m_digital_car_mode = digital;
-            m_update_car_mode = true;
+            schedule_car_mode();
         }
     }
 
@@ -97,6 +164,21 @@ class sclx_task : public tasks::serial_io_task {
         return m_last_update;
     }
 
+    inline const stats_t& stats() const {
+        return m_stats;
+    }
+
+    // time in microseconds from the packet with a throttle/brake change of a lane to the written drive packet
+    inline const sclx_histogram& latency(std::uint8_t carid) const {
+        return m_latency[carid];
+    }
+    void reset_latency();
+
+    // time in microseconds from storing a virtual handset state to the written drive packet
+    inline const sclx_histogram& virtual_latency(std::uint8_t carid) const {
+        return m_virtual_latency[carid];
+    }
+
     // event handlers
     typedef std::function<void(std::uint8_t btn)> button_func_t;
     void on_button_press(button_func_t f) {
@@ -118,6 +200,14 @@ class sclx_task : public tasks::serial_io_task {
         m_on_false_start_func = f;
     }
 
+    // Time from the green light to the first throttle of a car in microseconds of the powerbase game time. A car that
+    // was given throttle after the race was set up but before the green light made a jump start, it is reported
+    // with the (negative) time when the light goes green.
+    typedef std::function<void(std::uint8_t carid, std::int64_t reaction_time, bool jump_start)> reaction_func_t;
+    void on_reaction(reaction_func_t f) {
+        m_on_reaction_func = f;
+    }
+
     typedef std::function<void(std::uint64_t game_time, std::vector<std::uint8_t>& positions)> game_update_func_t;
     void on_game_finished(game_update_func_t f) {
         m_on_game_finished_func = f;
@@ -126,13 +216,34 @@ class sclx_task : public tasks::serial_io_task {
         m_on_game_update_func = f;
     }
 
+    typedef std::function<void(std::uint8_t id, std::uint8_t power, bool brake, bool lane_change)> handset_func_t;
+    void on_handset_change(handset_func_t f) {
+        m_on_handset_func = f;
+    }
+
     typedef std::function<void(std::uint8_t id, bool connected)> controller_func_t;    
     void on_controller_change(controller_func_t f) {
         m_on_controller_func = f;
     }
 
+    // a car set a new best lap of the game, with its handset trace for a ghost car
+    typedef std::function<void(std::uint8_t carid, std::shared_ptr<const sclx_ghost::lap_t> lap)> ghost_lap_func_t;
+    void on_ghost_lap(ghost_lap_func_t f) {
+        m_on_ghost_lap_func = f;
+    }
+
+    // the events of one powerbase cycle are handed over at once, f has to call run_events
+    typedef std::function<void(const std::function<void()>& run_events)> batch_func_t;
+    void on_event_batch(batch_func_t f) {
+        m_on_batch_func = f;
+    }
+
   private:
-    std::string m_port;
+    // the micro benchmarks drive the update functions directly, the tests replay packets through the transport
+    friend class sclx_task_bench;
+    friend class sclx_task_test;
+
+    std::unique_ptr<sclx_transport> m_transport;
     bool m_powerbase_connected = false;
 
     // used to order cars by position
@@ -158,7 +269,6 @@ class sclx_task : public tasks::serial_io_task {
     // game data
     struct game_data_t {
         std::atomic<game_state_t> state;
-        std::atomic<std::uint8_t> reset;
         std::uint8_t laps;
         std::uint64_t game_time;        
         std::uint8_t active_cars;
@@ -172,31 +282,92 @@ class sclx_task : public tasks::serial_io_task {
     int m_in_cur = 0;
     int m_in_last = 1;
     std::chrono::steady_clock::time_point m_last_update;
+    std::int64_t m_cycle_mean_us = 0;
+    stats_t m_stats;
+
+    sclx_histogram m_latency[sclx::LANES];
+    std::uint8_t m_latency_pending = 0;  // lane mask
+    std::chrono::steady_clock::time_point m_latency_start;
     std::uint64_t m_post_next_game_update = 0;
+    std::atomic<std::uint64_t> m_game_update_interval{1000000};
+    std::atomic<bool> m_handset_events{false};
+
+    // virtual handsets: per lane the active flag, the receive time in us (48 bits) and the handset byte
+    static constexpr std::uint64_t VIRTUAL_ACTIVE = UINT64_C(1) << 63;
+    static constexpr std::uint64_t VIRTUAL_TIME_MASK = (UINT64_C(1) << 48) - 1;
+    std::atomic<std::uint64_t> m_virtual[sclx::LANES];
+    std::atomic<std::uint8_t> m_virtual_active{0};   // lane mask
+    std::atomic<std::uint64_t> m_virtual_timeout_us{250000};
+    std::uint8_t m_virtual_lanes = 0;                // lanes driven by a virtual handset in the last cycle
+    std::uint64_t m_virtual_word = 0;                // their handset bytes
+    std::uint8_t m_virtual_stale = 0;                // lane mask
+    sclx_histogram m_virtual_latency[sclx::LANES];
+    std::uint8_t m_virtual_pending = 0;              // lane mask
+    std::uint64_t m_virtual_start[sclx::LANES];
+
+    // ghost car: the recorded laps and the player belong to the serial thread, a new player is handed over by
+    // start_ghost/stop_ghost
+    sclx_ghost::recorder m_recorders[sclx::LANES];
+    std::unique_ptr<sclx_ghost::player> m_ghost;
+    std::atomic<sclx_ghost::player*> m_ghost_next{nullptr};
+    std::atomic<std::uint8_t> m_ghost_lane{sclx::LANES};
+    std::uint8_t m_ghost_lanes = 0;                  // lane driven by the ghost car in the last cycle
+    std::uint64_t m_ghost_word = 0;                  // its handset byte
+    std::uint32_t m_lost_cycles = 0;                 // packets with a bad CRC since the last cycle
+
+    // reaction times, the serial thread takes over the new race with m_reaction_arm
+    std::atomic<bool> m_reaction_arm{false};
+    std::uint8_t m_reaction_pending = 0;             // lanes without throttle since the race was set up
+    std::uint8_t m_jump_start = 0;                   // lanes with throttle before the green light
+    std::uint64_t m_first_throttle[sclx::LANES];     // race clock in us
+    std::uint64_t m_start_time = 0;                  // race clock of the green light in us
+    // the start light frames restart the game clock of the powerbase, the race clock is the game time plus the
+    // time the powerbase clock had reached before each restart
+    std::uint64_t m_clock_offset = 0;
 
     std::atomic<bool> m_game_reset;
     std::atomic<bool> m_game_start;
 
     game_data_t m_game;
-    car_data_t m_cars[6];
-    bool m_ctrl_connected[6] = {false, false, false, false, false, false};
-
-    std::uint8_t m_bind_id = 6;
-    std::chrono::steady_clock::time_point m_bind_start;
+    car_data_t m_cars[sclx::LANES];
+    // power rate, throttle curve and back power table of the cars for the threads that change them
+    std::mutex m_mtx_power_maps;
+    static constexpr std::uint8_t POWER_MAP_NEW = 0x80;
+    std::uint8_t m_ctrl_connected = 0;   // lane mask
+    std::atomic<std::uint8_t> m_physical_handsets{0};  // m_ctrl_connected for the other threads
+    std::uint8_t m_active_lanes = 0;     // lane mask of the cars in the current game
 
     bool m_digital_car_mode = true;
-    std::atomic<bool> m_update_car_mode;
+
+    // special outbound frames, the base LEDs are the handset LEDs of the last packet or the ones set with set_leds
+    sclx_out_schedule m_schedule;
+    std::uint8_t m_leds = sclx::LED_GREEN | sclx::LED_RED;
+    // sequence priorities and events
+    enum : std::uint8_t { PRIO_CAR_MODE, PRIO_START_LIGHTS, PRIO_BINDING };
+    enum : std::uint8_t { EVENT_START_LIGHTS, EVENT_BIND_DONE };
 
     // event handlers
     button_func_t m_on_button_func = [](std::uint8_t) {};
     state_func_t m_on_state_func = [](game_state_t) {};
     lap_func_t m_on_lap_func = [](std::uint8_t, std::uint8_t, std::uint64_t, bool) {};
     false_start_func_t m_on_false_start_func = [](std::uint8_t) {};
+    reaction_func_t m_on_reaction_func = [](std::uint8_t, std::int64_t, bool) {};
     game_update_func_t m_on_game_finished_func = [](std::uint64_t, std::vector<std::uint8_t>&) {};
     game_update_func_t m_on_game_update_func = [](std::uint64_t, std::vector<std::uint8_t>&) {};
     controller_func_t m_on_controller_func = [] (std::uint8_t, bool) {};
+    handset_func_t m_on_handset_func = [](std::uint8_t, std::uint8_t, bool, bool) {};
+    ghost_lap_func_t m_on_ghost_lap_func = [](std::uint8_t, std::shared_ptr<const sclx_ghost::lap_t>) {};
+    batch_func_t m_on_batch_func = [](const std::function<void()>& run_events) { run_events(); };
 
-    void init_term();
+    // events raised while handling a powerbase packet
+    std::vector<std::function<void()>> m_cycle_events;
+
+    void init_transport();
+
+    // hand an event to the tasks::exec pool and keep track of the queue depth, events raised while handling a
+    // powerbase packet are collected and passed on as one batch at the end of the cycle
+    void exec(std::function<void()> f, bool batch = true);
+    void post_cycle_events();
 
     inline void switch_in_packets() {
         if (m_in_cur) {
@@ -215,14 +386,32 @@ class sclx_task : public tasks::serial_io_task {
 
     void set_game_state(game_state_t state);
 
+    void schedule(const sclx_out_schedule::sequence_t& seq);
+    // the green and red light for a packet, then the green one (the state changes from STARTING to RACE then)
+    void schedule_start_lights();
+    void schedule_car_mode();
+    // compose the special frames into the next packet and handle the events
+    void compose_packet();
+
     void handle_data();
+    void update_cycle_stats(std::chrono::steady_clock::time_point now);
+    void record_latency();
+    std::uint8_t apply_virtual_handsets(std::uint64_t& cur, std::uint64_t& last);
+    std::uint8_t apply_ghost(std::uint64_t& cur, std::uint64_t& last, std::uint8_t taken);
+    void record_laps(std::uint64_t cur, std::uint8_t lanes);
+    void record_reactions(std::uint64_t cur, std::uint8_t changed);
+    inline std::uint64_t race_clock(const sclx_in::packet_t& packet) const {
+        return m_clock_offset + static_cast<std::uint64_t>(6.4 * packet.game_time_sf);
+    }
+    void post_reactions(std::uint8_t lanes);
     void set_drive_data(std::uint8_t carid, bool enable, std::uint8_t bit);
+    void set_drive_power(std::uint8_t carid, std::uint8_t power);
+    void update_power_map(std::uint8_t carid);
     
     void update_leds();
     void update_handsets();
     void update_game();
     void update_buttons();
-    void update_ctrl_connected(std::uint8_t id, bool connected);
 
     void post_game_update(bool finished, std::uint64_t game_time);
 };
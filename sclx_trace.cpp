@@ -0,0 +1,93 @@
+#include <signal.h>
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "sclx_trace.h"
+
+struct sclx_trace::ring_t {
+    int tid;
+    // only the owning thread writes, readers use head to find the valid records
+    std::atomic<std::uint64_t> head{0};
+    record_t records[RING_SIZE];
+};
+
+namespace {
+
+std::mutex rings_mtx;
+// rings are never freed, our threads live as long as the process
+std::vector<std::unique_ptr<sclx_trace::ring_t>>& rings() {
+    static std::vector<std::unique_ptr<sclx_trace::ring_t>> r;
+    return r;
+}
+
+}  // namespace
+
+std::atomic<bool> sclx_trace::m_dump_requested(false);
+
+sclx_trace::ring_t& sclx_trace::ring() {
+    thread_local ring_t* r = nullptr;
+    if (nullptr == r) {
+        std::lock_guard<std::mutex> lock(rings_mtx);
+        rings().emplace_back(new ring_t());
+        r = rings().back().get();
+        r->tid = rings().size();
+    }
+    return *r;
+}
+
+void sclx_trace::record(const char* name, std::uint64_t start, std::uint64_t end) {
+    ring_t& r = ring();
+    std::uint64_t head = r.head.load(std::memory_order_relaxed);
+    record_t& rec = r.records[head & (RING_SIZE - 1)];
+    rec.name = name;
+    rec.start = start;
+    rec.dur = end - start;
+    r.head.store(head + 1, std::memory_order_release);
+}
+
+void sclx_trace::dump(std::ostream& out) {
+    std::vector<record_t> records;
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    std::lock_guard<std::mutex> lock(rings_mtx);
+    for (auto& r : rings()) {
+        // copy the ring while the owner keeps writing, then drop what got overwritten during the copy
+        std::uint64_t head = r->head.load(std::memory_order_acquire);
+        std::uint64_t from = head > RING_SIZE ? head - RING_SIZE : 0;
+        records.clear();
+        for (std::uint64_t i = from; i < head; i++) {
+            records.push_back(r->records[i & (RING_SIZE - 1)]);
+        }
+        std::uint64_t head_after = r->head.load(std::memory_order_acquire);
+        std::uint64_t valid_from = head_after > RING_SIZE ? head_after - RING_SIZE : 0;
+        for (std::uint64_t i = std::max(from, valid_from); i < head; i++) {
+            auto& rec = records[i - from];
+            out << (first ? "" : ",") << "\n{\"name\":\"" << rec.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << r->tid
+                << ",\"ts\":" << rec.start / 1000 << "." << rec.start % 1000 / 100 << ",\"dur\":" << rec.dur / 1000
+                << "." << rec.dur % 1000 / 100 << "}";
+            first = false;
+        }
+    }
+    out << "\n]}\n";
+}
+
+bool sclx_trace::dump(const std::string& path) {
+    std::ofstream file(path);
+    if (file.good()) {
+        dump(file);
+        return true;
+    }
+    return false;
+}
+
+void sclx_trace::install_signal_handler() {
+    signal(SIGUSR1, [](int) { m_dump_requested = true; });
+}
+
+bool sclx_trace::dump_requested() {
+    return m_dump_requested.exchange(false);
+}
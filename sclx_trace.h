@@ -0,0 +1,70 @@
+#ifndef SCLX_TRACE_H_
+#define SCLX_TRACE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Hot path tracing. Trace points write fixed size records into a lock free ring per thread, the rings can be dumped
+// as Chrome/Perfetto trace JSON (chrome://tracing, ui.perfetto.dev). The trace points are only compiled in with
+// -DSCLX_TRACE=ON, otherwise the macros expand to nothing.
+class sclx_trace {
+  public:
+    struct record_t {
+        const char* name;  // must be a string literal
+        std::uint64_t start;
+        std::uint64_t dur;
+    };
+
+    // records per thread, power of two
+    static constexpr std::size_t RING_SIZE = 8192;
+    struct ring_t;
+
+    // nanoseconds on the steady clock
+    static inline std::uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    static void record(const char* name, std::uint64_t start, std::uint64_t end);
+
+    static void dump(std::ostream& out);
+    static bool dump(const std::string& path);
+
+    // SIGUSR1 requests a dump, the owner of the main loop has to poll dump_requested()
+    static void install_signal_handler();
+    static bool dump_requested();
+
+    class scope {
+      public:
+        scope(const char* name) : m_name(name), m_start(now()) {}
+        ~scope() { record(m_name, m_start, now()); }
+
+      private:
+        const char* m_name;
+        std::uint64_t m_start;
+    };
+
+  private:
+    static ring_t& ring();
+    static std::atomic<bool> m_dump_requested;
+};
+
+#ifdef SCLX_TRACE
+#define SCLX_TRACE_CONCAT_(a, b) a##b
+#define SCLX_TRACE_CONCAT(a, b) SCLX_TRACE_CONCAT_(a, b)
+// trace the rest of the current scope
+#define SCLX_TRACE_SCOPE(name) sclx_trace::scope SCLX_TRACE_CONCAT(sclx_trace_scope_, __LINE__)(name)
+// trace a span that started at a time taken with SCLX_TRACE_NOW(), possibly on another thread
+#define SCLX_TRACE_NOW() sclx_trace::now()
+#define SCLX_TRACE_SPAN(name, start) sclx_trace::record(name, start, sclx_trace::now())
+#else
+#define SCLX_TRACE_SCOPE(name)
+#define SCLX_TRACE_NOW() 0
+#define SCLX_TRACE_SPAN(name, start)
+#endif
+
+#endif  // SCLX_TRACE_H_
@@ -0,0 +1,202 @@
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+//#define _WITH_PUT_TIME
+#define _WITH_SHORT_LOG
+#include <tasks/logging.h>
+
+#include "sclx_transport.h"
+#include "sclx_in.h"
+
+namespace {
+
+inline tasks::tasks_exception transport_error(const std::string& what) {
+    return tasks::tasks_exception(tasks::tasks_error::UNSET, what + ": " + std::string(std::strerror(errno)), errno);
+}
+
+// map "would block" to 0 bytes, so the caller simply waits for the next event
+inline std::streamsize io_result(ssize_t bytes) {
+    if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return 0;
+    }
+    return bytes;
+}
+
+}  // namespace
+
+std::unique_ptr<sclx_transport> sclx_transport::create(const std::string& spec) {
+    if (spec == "pty") {
+        return std::unique_ptr<sclx_transport>(new sclx_pty_transport());
+    }
+    if (spec.compare(0, 6, "tcp://") == 0) {
+        std::string addr = spec.substr(6);
+        auto pos = addr.rfind(':');
+        if (pos == std::string::npos || pos == 0 || pos == addr.size() - 1) {
+            throw tasks::tasks_exception(tasks::tasks_error::UNSET, "invalid tcp transport " + spec +
+                                                                        ", expected tcp://host:port");
+        }
+        return std::unique_ptr<sclx_transport>(new sclx_tcp_transport(addr.substr(0, pos), addr.substr(pos + 1)));
+    }
+    return std::unique_ptr<sclx_transport>(new sclx_serial_transport(spec));
+}
+
+void sclx_serial_transport::open() {
+    m_term.open(m_port, B19200, tasks::serial::termmode_t::_8N1);
+
+    // update term settings
+    struct termios opts = m_term.options();
+    opts.c_iflag &= ~(IGNBRK | BRKINT | ICRNL | INLCR | PARMRK | INPCK | ISTRIP | IXON);
+    opts.c_lflag &= ~(ECHO | ECHONL | ICANON | IEXTEN | ISIG);
+    opts.c_oflag = 0;
+    opts.c_cc[VTIME] = 0;
+    opts.c_cc[VMIN] = sizeof(sclx_in::packet_t);
+    m_term.set_options(opts);
+}
+
+void sclx_serial_transport::close() {
+    m_term.close();
+}
+
+std::streamsize sclx_serial_transport::read(char* data, std::streamsize len) {
+    return m_term.read(data, len);
+}
+
+std::streamsize sclx_serial_transport::write(const char* data, std::streamsize len) {
+    return m_term.write(data, len);
+}
+
+void sclx_serial_transport::discard_input() {
+    tcflush(m_term.fd(), TCIFLUSH);
+}
+
+sclx_pty_transport::sclx_pty_transport() {
+    m_fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (m_fd < 0) {
+        throw transport_error("posix_openpt failed");
+    }
+    if (grantpt(m_fd) < 0 || unlockpt(m_fd) < 0) {
+        ::close(m_fd);
+        m_fd = -1;
+        throw transport_error("unlocking pty failed");
+    }
+    struct termios opts;
+    if (tcgetattr(m_fd, &opts) == 0) {
+        cfmakeraw(&opts);
+        tcsetattr(m_fd, TCSANOW, &opts);
+    }
+    m_slave = ptsname(m_fd);
+    m_slave_fd = ::open(m_slave.c_str(), O_RDWR | O_NOCTTY);
+    if (m_slave_fd < 0) {
+        tasks::tasks_exception e = transport_error("opening pty slave " + m_slave + " failed");
+        ::close(m_fd);
+        m_fd = -1;
+        throw e;
+    }
+    terr("sclx_pty_transport: powerbase pty is " << m_slave << std::endl);
+}
+
+sclx_pty_transport::~sclx_pty_transport() {
+    ::close(m_slave_fd);
+    ::close(m_fd);
+}
+
+void sclx_pty_transport::open() {
+    // keep the pty and its slave path, just drop what is left of the stream that got out of sync
+    tcflush(m_fd, TCIOFLUSH);
+}
+
+std::streamsize sclx_pty_transport::read(char* data, std::streamsize len) {
+    return io_result(::read(m_fd, data, len));
+}
+
+std::streamsize sclx_pty_transport::write(const char* data, std::streamsize len) {
+    return io_result(::write(m_fd, data, len));
+}
+
+void sclx_pty_transport::discard_input() {
+    tcflush(m_fd, TCIFLUSH);
+}
+
+void sclx_tcp_transport::open() {
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = nullptr;
+    int rc = getaddrinfo(m_host.c_str(), m_port.c_str(), &hints, &res);
+    if (rc != 0) {
+        throw tasks::tasks_exception(tasks::tasks_error::UNSET,
+                                     "resolving " + m_host + " failed: " + std::string(gai_strerror(rc)));
+    }
+    int err = 0;
+    for (auto ai = res; nullptr != ai && m_fd < 0; ai = ai->ai_next) {
+        m_fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK, ai->ai_protocol);
+        if (m_fd < 0) {
+            err = errno;
+            continue;
+        }
+        err = 0;
+        if (connect(m_fd, ai->ai_addr, ai->ai_addrlen) < 0) {
+            err = errno;
+            if (err == EINPROGRESS) {
+                // don't block the worker longer than a powerbase cycle reset interval
+                struct pollfd pfd = {m_fd, POLLOUT, 0};
+                socklen_t err_len = sizeof(err);
+                err = ETIMEDOUT;
+                if (poll(&pfd, 1, 1000) == 1) {
+                    getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+                }
+            }
+        }
+        if (err != 0) {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (m_fd < 0) {
+        errno = err;
+        throw transport_error("connecting to " + name() + " failed");
+    }
+    // frames are tiny and latency matters
+    int one = 1;
+    setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    terr("sclx_tcp_transport: connected to " << name() << std::endl);
+}
+
+void sclx_tcp_transport::close() {
+    if (m_fd > -1) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+std::streamsize sclx_tcp_transport::read(char* data, std::streamsize len) {
+    ssize_t bytes = recv(m_fd, data, len, 0);
+    if (bytes == 0 && len > 0) {
+        // the bridge went away
+        errno = ECONNRESET;
+        return -1;
+    }
+    return io_result(bytes);
+}
+
+std::streamsize sclx_tcp_transport::write(const char* data, std::streamsize len) {
+    return io_result(send(m_fd, data, len, MSG_NOSIGNAL));
+}
+
+void sclx_tcp_transport::discard_input() {
+    // a socket has no input queue to flush, read it empty. A closed connection is left for the next read.
+    char buf[256];
+    while (recv(m_fd, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef SCLX_TRANSPORT_H_
+#define SCLX_TRANSPORT_H_
+
+#include <tasks/serial/term.h>
+
+#include <memory>
+#include <string>
+
+// Frame I/O to the powerbase. The sclx_task only needs a non blocking file descriptor to watch and read/write
+// calls, so the same race engine can talk to a local UART, a pseudo terminal (simulators, replays) or a remote
+// powerbase that is exposed by sclx_bridge over TCP.
+class sclx_transport {
+  public:
+    virtual ~sclx_transport() {}
+
+    virtual void open() = 0;
+    virtual void close() = 0;
+
+    // Return the number of bytes transferred, 0 if the call would block or -1 on error (errno is set).
+    virtual std::streamsize read(char* data, std::streamsize len) = 0;
+    virtual std::streamsize write(const char* data, std::streamsize len) = 0;
+    // Drop the input that already arrived. Called after a packet with a bad CRC: the powerbase waits for the next
+    // drive packet then, so whatever is left belongs to a frame that lost its alignment.
+    virtual void discard_input() = 0;
+
+    virtual int fd() const = 0;
+    virtual std::string name() const = 0;
+
+    // Create a transport from a device spec:
+    //   /dev/ttyUSB0      serial port
+    //   pty               new pseudo terminal, the slave path gets logged
+    //   tcp://host:port   powerbase forwarded by sclx_bridge
+    static std::unique_ptr<sclx_transport> create(const std::string& spec);
+};
+
+class sclx_serial_transport : public sclx_transport {
+  public:
+    sclx_serial_transport(std::string port) : m_port(port) {}
+
+    void open();
+    void close();
+    std::streamsize read(char* data, std::streamsize len);
+    std::streamsize write(const char* data, std::streamsize len);
+    void discard_input();
+
+    inline int fd() const { return m_term.fd(); }
+    inline std::string name() const { return m_port; }
+
+  private:
+    std::string m_port;
+    tasks::serial::term m_term;
+};
+
+// The pty is created once, so a simulator attached to the slave survives cycle resets. open/close only flush it.
+class sclx_pty_transport : public sclx_transport {
+  public:
+    sclx_pty_transport();
+    ~sclx_pty_transport();
+
+    void open();
+    void close() {}
+    std::streamsize read(char* data, std::streamsize len);
+    std::streamsize write(const char* data, std::streamsize len);
+    void discard_input();
+
+    inline int fd() const { return m_fd; }
+    inline std::string name() const { return m_slave; }
+
+  private:
+    int m_fd = -1;
+    // we hold the slave side open, otherwise the master reports EIO/hangup until a simulator attaches
+    int m_slave_fd = -1;
+    std::string m_slave;
+};
+
+class sclx_tcp_transport : public sclx_transport {
+  public:
+    sclx_tcp_transport(std::string host, std::string port) : m_host(host), m_port(port) {}
+    ~sclx_tcp_transport() { close(); }
+
+    void open();
+    void close();
+    std::streamsize read(char* data, std::streamsize len);
+    std::streamsize write(const char* data, std::streamsize len);
+    void discard_input();
+
+    inline int fd() const { return m_fd; }
+    inline std::string name() const { return "tcp://" + m_host + ":" + m_port; }
+
+  private:
+    std::string m_host;
+    std::string m_port;
+    int m_fd = -1;
+};
+
+#endif  // SCLX_TRANSPORT_H_
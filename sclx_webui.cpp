@@ -0,0 +1,358 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include <tasks/tasks_exception.h>
+
+#include "sclx_webui.h"
+
+namespace {
+
+inline tasks::tasks_exception webui_error(const std::string& what) {
+    return tasks::tasks_exception(tasks::tasks_error::UNSET, what + ": " + std::string(std::strerror(errno)), errno);
+}
+
+const char* content_type(const std::string& path) {
+    static const struct {
+        const char* ext;
+        const char* type;
+    } types[] = {
+        {".html", "text/html; charset=utf-8"},
+        {".js", "application/javascript; charset=utf-8"},
+        {".css", "text/css; charset=utf-8"},
+        {".json", "application/json"},
+        {".svg", "image/svg+xml"},
+        {".png", "image/png"},
+        {".jpg", "image/jpeg"},
+        {".gif", "image/gif"},
+        {".ico", "image/x-icon"},
+        {".wav", "audio/wav"},
+        {".mp3", "audio/mpeg"},
+        {".woff", "font/woff"},
+        {".woff2", "font/woff2"},
+        {".ttf", "font/ttf"},
+        {".otf", "font/otf"},
+        {".eot", "application/vnd.ms-fontobject"},
+        {".txt", "text/plain; charset=utf-8"},
+    };
+    auto dot = path.rfind('.');
+    if (dot != std::string::npos) {
+        std::string ext = path.substr(dot);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        for (auto& t : types) {
+            if (ext == t.ext) {
+                return t.type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+// images, audio and fonts are compressed already
+inline bool compressible(const std::string& type) {
+    return type.compare(0, 5, "text/") == 0 || type.compare(0, 22, "application/javascript") == 0 ||
+           type == "application/json" || type == "image/svg+xml" || type == "image/x-icon" ||
+           type == "application/vnd.ms-fontobject" || type == "font/ttf" || type == "font/otf";
+}
+
+std::string gzip(const std::string& data) {
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    // 15 + 16: gzip header and trailer
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return std::string();
+    }
+    std::string out(deflateBound(&stream, data.size()), '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = data.size();
+    stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    stream.avail_out = out.size();
+    int ret = deflate(&stream, Z_FINISH);
+    out.resize(out.size() - stream.avail_out);
+    deflateEnd(&stream);
+    return ret == Z_STREAM_END ? out : std::string();
+}
+
+// strong validator from the content
+std::string make_etag(const std::string& data, const char* suffix) {
+    static const char hex[] = "0123456789abcdef";
+    std::string sha1 = SimpleWeb::Crypto::SHA1(data);
+    std::string etag = "\"";
+    for (std::size_t i = 0; i < 8; i++) {
+        etag += hex[static_cast<unsigned char>(sha1[i]) >> 4];
+        etag += hex[static_cast<unsigned char>(sha1[i]) & 0xf];
+    }
+    etag += suffix;
+    etag += '"';
+    return etag;
+}
+
+inline std::string trim(const std::string& str) {
+    auto begin = str.find_first_not_of(" \t");
+    if (begin == std::string::npos) {
+        return std::string();
+    }
+    return str.substr(begin, str.find_last_not_of(" \t") - begin + 1);
+}
+
+std::vector<std::string> split(const std::string& str, char sep) {
+    std::vector<std::string> parts;
+    std::istringstream in(str);
+    std::string part;
+    while (std::getline(in, part, sep)) {
+        parts.push_back(trim(part));
+    }
+    return parts;
+}
+
+const std::string* header(const sclx_webui::connection_ptr_t& conn, const char* name) {
+    auto it = conn->header.find(name);
+    return it == conn->header.end() ? nullptr : &it->second;
+}
+
+// Accept-Encoding lists gzip (or *) without q=0
+bool accepts_gzip(const std::string& accept) {
+    for (auto& coding : split(accept, ',')) {
+        auto params = split(coding, ';');
+        if (params.empty() || (params[0] != "gzip" && params[0] != "*")) {
+            continue;
+        }
+        bool rejected = false;
+        for (std::size_t i = 1; i < params.size(); i++) {
+            if (params[i].compare(0, 2, "q=") == 0 && std::strtod(params[i].c_str() + 2, nullptr) <= 0) {
+                rejected = true;
+            }
+        }
+        return !rejected;
+    }
+    return false;
+}
+
+// If-None-Match uses the weak comparison
+bool etag_matches(const std::string& if_none_match, const sclx_webui::asset_t& asset) {
+    for (auto& tag : split(if_none_match, ',')) {
+        if (tag.compare(0, 2, "W/") == 0) {
+            tag = tag.substr(2);
+        }
+        if (tag == "*" || tag == asset.etag || (asset.gzip && tag == asset.gzip_etag)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+enum class range_t { NONE, OK, UNSATISFIABLE };
+
+// a single byte range, media players ask for those, several ranges get the whole file
+range_t parse_range(const std::string& value, std::size_t size, std::size_t& offset, std::size_t& length) {
+    if (0 == size || value.compare(0, 6, "bytes=") != 0 || value.find(',') != std::string::npos) {
+        return range_t::NONE;
+    }
+    std::string spec = trim(value.substr(6));
+    auto dash = spec.find('-');
+    if (dash == std::string::npos || spec.find_first_not_of("0123456789-") != std::string::npos) {
+        return range_t::NONE;
+    }
+    std::string first = spec.substr(0, dash);
+    std::string last = spec.substr(dash + 1);
+    if (first.empty()) {
+        // suffix: the last n bytes
+        if (last.empty()) {
+            return range_t::NONE;
+        }
+        std::size_t n = std::strtoull(last.c_str(), nullptr, 10);
+        if (0 == n) {
+            return range_t::UNSATISFIABLE;
+        }
+        length = std::min(n, size);
+        offset = size - length;
+        return range_t::OK;
+    }
+    offset = std::strtoull(first.c_str(), nullptr, 10);
+    std::size_t end = last.empty() ? size - 1 : std::strtoull(last.c_str(), nullptr, 10);
+    if (offset >= size) {
+        return range_t::UNSATISFIABLE;
+    }
+    if (end < offset) {
+        return range_t::NONE;
+    }
+    length = std::min(end, size - 1) - offset + 1;
+    return range_t::OK;
+}
+
+}  // namespace
+
+sclx_webui::sclx_webui(const std::string& dir) : m_dir(dir) {
+    while (m_dir.size() > 1 && m_dir.back() == '/') {
+        m_dir.pop_back();
+    }
+    load_dir("");
+}
+
+sclx_webui::~sclx_webui() {
+    for (auto& asset : m_assets) {
+        if (asset->fd >= 0) {
+            close(asset->fd);
+        }
+    }
+}
+
+void sclx_webui::load_dir(const std::string& rel) {
+    std::string path = m_dir + rel;
+    DIR* dir = opendir(path.c_str());
+    if (nullptr == dir) {
+        throw webui_error("can't open " + path);
+    }
+    std::vector<std::string> names;
+    while (auto entry = readdir(dir)) {
+        // skip hidden files and the dependency scripts
+        std::string name = entry->d_name;
+        if (name[0] != '.' && (name.size() < 3 || name.compare(name.size() - 3, 3, ".sh") != 0)) {
+            names.push_back(name);
+        }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    for (auto& name : names) {
+        struct stat st;
+        std::string entry_rel = rel + "/" + name;
+        if (stat((m_dir + entry_rel).c_str(), &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            load_dir(entry_rel);
+        } else if (S_ISREG(st.st_mode)) {
+            load_file(entry_rel);
+        }
+    }
+}
+
+void sclx_webui::load_file(const std::string& rel) {
+    std::string path = m_dir + rel;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw webui_error("can't open " + path);
+    }
+    std::string data;
+    char chunk[65536];
+    ssize_t n;
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+        data.append(chunk, n);
+    }
+    if (n < 0) {
+        close(fd);
+        throw webui_error("can't read " + path);
+    }
+
+    std::unique_ptr<asset_t> asset(new asset_t);
+    asset->path = rel;
+    asset->content_type = content_type(rel);
+    // the app itself changes with every release, dependencies and media are revalidated once an hour
+    asset->cache_control = rel.find('/', 1) == std::string::npos ? "no-cache" : "max-age=3600";
+    asset->etag = make_etag(data, "");
+    asset->size = data.size();
+    if (compressible(asset->content_type)) {
+        std::string compressed = gzip(data);
+        // keep it if it saves at least 10%
+        if (!compressed.empty() && compressed.size() < data.size() - data.size() / 10) {
+            asset->gzip = std::make_shared<const std::string>(std::move(compressed));
+            asset->gzip_etag = make_etag(data, "-gz");
+        }
+    }
+    if (data.size() >= SENDFILE_MIN && !asset->gzip) {
+        asset->fd = fd;
+    } else {
+        close(fd);
+        asset->body = std::make_shared<const std::string>(std::move(data));
+    }
+    m_assets.push_back(std::move(asset));
+}
+
+std::size_t sclx_webui::memory() const {
+    std::size_t bytes = 0;
+    for (auto& asset : m_assets) {
+        bytes += (asset->body ? asset->body->size() : 0) + (asset->gzip ? asset->gzip->size() : 0);
+    }
+    return bytes;
+}
+
+void sclx_webui::install(server_t& server) {
+    for (auto& asset : m_assets) {
+        const asset_t* a = asset.get();
+        auto handler = [a](connection_ptr_t conn, server_t::Response& response) { respond(*a, conn, response); };
+        server.path_resource[asset->path] = handler;
+        if (asset->path == "/index.html") {
+            server.path_resource["/"] = handler;
+        }
+    }
+}
+
+void sclx_webui::respond(const asset_t& asset, const connection_ptr_t& conn, server_t::Response& response) {
+    auto accept_encoding = header(conn, "Accept-Encoding");
+    bool use_gzip = asset.gzip && nullptr != accept_encoding && accepts_gzip(*accept_encoding);
+    const std::string& etag = use_gzip ? asset.gzip_etag : asset.etag;
+
+    response.keep_alive = true;
+    auto if_none_match = header(conn, "If-None-Match");
+    if (nullptr != if_none_match && etag_matches(*if_none_match, asset)) {
+        response << "HTTP/1.1 304 Not Modified\r\n";
+        response << "ETag: " << etag << "\r\n";
+        response << "Cache-Control: " << asset.cache_control << "\r\n";
+        if (asset.gzip) {
+            response << "Vary: Accept-Encoding\r\n";
+        }
+        response << "\r\n";
+        return;
+    }
+
+    // ranges of the uncompressed content only, If-Range falls back to the whole content if the asset changed
+    std::size_t offset = 0;
+    std::size_t length = asset.size;
+    range_t range = range_t::NONE;
+    auto range_header = header(conn, "Range");
+    auto if_range = header(conn, "If-Range");
+    if (!use_gzip && nullptr != range_header && (nullptr == if_range || *if_range == asset.etag)) {
+        range = parse_range(*range_header, asset.size, offset, length);
+    }
+    if (range_t::UNSATISFIABLE == range) {
+        response << "HTTP/1.1 416 Range Not Satisfiable\r\n";
+        response << "Content-Range: bytes */" << asset.size << "\r\n";
+        response << "Content-Length: 0\r\n\r\n";
+        return;
+    }
+
+    if (range_t::OK == range) {
+        response << "HTTP/1.1 206 Partial Content\r\n";
+        response << "Content-Range: bytes " << offset << "-" << offset + length - 1 << "/" << asset.size << "\r\n";
+    } else {
+        response << "HTTP/1.1 200 OK\r\n";
+    }
+    response << "Content-Type: " << asset.content_type << "\r\n";
+    response << "Content-Length: " << (use_gzip ? asset.gzip->size() : length) << "\r\n";
+    response << "ETag: " << etag << "\r\n";
+    response << "Cache-Control: " << asset.cache_control << "\r\n";
+    response << "Accept-Ranges: bytes\r\n";
+    if (asset.gzip) {
+        response << "Vary: Accept-Encoding\r\n";
+    }
+    if (use_gzip) {
+        response << "Content-Encoding: gzip\r\n";
+    }
+    response << "\r\n";
+
+    if (use_gzip) {
+        response.body(asset.gzip);
+    } else if (asset.body) {
+        response.body(asset.body, offset, length);
+    } else {
+        response.file(asset.fd, offset, length);
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef SCLX_WEBUI_H_
+#define SCLX_WEBUI_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "websocket/server_ws.hpp"
+
+// The web ui served by the websocket server. All files of the webui directory are read at startup: text assets are
+// kept in memory with a precompressed gzip variant, large media stays on disk and goes out with sendfile. Every asset
+// has a strong ETag, so a reload costs a 304 per file.
+class sclx_webui {
+  public:
+    using server_t = SimpleWeb::SocketServerBase<SimpleWeb::WS>;
+    using connection_ptr_t = std::shared_ptr<server_t::Connection>;
+
+    // files from this size on are sent from disk
+    static constexpr std::size_t SENDFILE_MIN = 128 * 1024;
+
+    struct asset_t {
+        std::string path;  // url path
+        std::string content_type;
+        std::string cache_control;
+        std::string etag;
+        std::size_t size = 0;
+        std::shared_ptr<const std::string> body;  // null if the file is sent from disk
+        std::shared_ptr<const std::string> gzip;  // null if it does not pay off
+        std::string gzip_etag;
+        int fd = -1;
+    };
+
+    // reads all files below dir, throws tasks::tasks_exception if dir can not be read
+    explicit sclx_webui(const std::string& dir);
+    ~sclx_webui();
+
+    sclx_webui(const sclx_webui&) = delete;
+    sclx_webui& operator=(const sclx_webui&) = delete;
+
+    // register the assets as resources, / serves index.html
+    void install(server_t& server);
+
+    inline const std::vector<std::unique_ptr<asset_t>>& assets() const { return m_assets; }
+
+    // bytes held in memory, including the gzip variants
+    std::size_t memory() const;
+
+    static void respond(const asset_t& asset, const connection_ptr_t& conn, server_t::Response& response);
+
+  private:
+    std::string m_dir;
+    std::vector<std::unique_ptr<asset_t>> m_assets;
+
+    void load_dir(const std::string& rel);
+    void load_file(const std::string& rel);
+};
+
+#endif  // SCLX_WEBUI_H_
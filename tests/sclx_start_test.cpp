@@ -0,0 +1,190 @@
+// Replays a race start through the pty transport and checks the reaction times. The powerbase model answers every
+// drive packet with the handset inputs of the cycle and restarts its game clock when the start lights go from
+// GREEN+RED to GREEN, like the real powerbase.
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+
+#include <tasks/dispatcher.h>
+
+#include "../crc.h"
+#include "../sclx_consts.h"
+#include "../sclx_task.h"
+
+namespace {
+
+constexpr std::uint32_t CYCLE_SF = 100;  // 640us per cycle
+constexpr std::int64_t CYCLE_US = 640;
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+struct reaction_t {
+    std::int64_t reaction_time;
+    bool jump_start;
+};
+
+std::mutex mtx;
+std::condition_variable cond;
+std::map<std::uint8_t, reaction_t> reactions;
+
+}  // namespace
+
+// the powerbase side of the pty
+class sclx_task_test {
+  public:
+    explicit sclx_task_test(sclx_task& task) : m_task(task) {
+        m_slave = ::open(m_task.m_transport->name().c_str(), O_RDWR | O_NOCTTY);
+        if (m_slave < 0) {
+            throw tasks::tasks_exception(tasks::tasks_error::UNSET, "opening the pty slave failed");
+        }
+        struct termios opts;
+        tcgetattr(m_slave, &opts);
+        cfmakeraw(&opts);
+        tcsetattr(m_slave, TCSANOW, &opts);
+    }
+
+    ~sclx_task_test() { ::close(m_slave); }
+
+    // One powerbase cycle: the drive packet goes out and the powerbase answers with the handset bytes of lane 1 and
+    // 2. Returns the led status of the drive packet.
+    std::uint8_t cycle(std::uint8_t power1, std::uint8_t power2) {
+        m_task.compose_packet();
+        while (!m_task.m_out.done()) {
+            m_task.m_out.write(*m_task.m_transport);
+        }
+        m_task.m_out.reset();
+        sclx_out::packet_t out;
+        read_all(reinterpret_cast<char*>(&out), sizeof(out));
+        if (out.op_mode == sclx::OP_DRIVE) {
+            // GREEN+RED followed by GREEN restarts the game clock
+            bool green = (out.led_status & (sclx::LED_GREEN | sclx::LED_RED)) == sclx::LED_GREEN;
+            if (green && m_green_red) {
+                m_game_time_sf = 0;
+            }
+            m_green_red = (out.led_status & (sclx::LED_GREEN | sclx::LED_RED)) == (sclx::LED_GREEN | sclx::LED_RED);
+        }
+
+        m_game_time_sf += CYCLE_SF;
+        sclx_in::packet_t in;
+        std::memset(&in, 0xff, sizeof(in));
+        in.status = sclx::TRACK_POWER_STATUS | sclx::handset(1) | sclx::handset(2);
+        in.handset[1] = ~power1;
+        in.handset[2] = ~power2;
+        in.aux_current = 0;
+        in.carid_sf = sclx::CARID_INVALID;
+        in.game_time_sf = m_game_time_sf;
+        in.button_status = 0xff;
+        in.crc = crc8(&in.status, sizeof(in) - 1);
+        if (::write(m_slave, &in, sizeof(in)) != sizeof(in)) {
+            throw tasks::tasks_exception(tasks::tasks_error::UNSET, "writing to the pty slave failed");
+        }
+        sclx_in& in_cur = m_task.m_in[m_task.m_in_cur];
+        while (!in_cur.done()) {
+            in_cur.read(*m_task.m_transport);
+        }
+        check(in_cur.valid(), "packet crc");
+        m_task.handle_data();
+        // the packet stays done as the last one, the other one takes the next packet
+        m_task.switch_in_packets();
+        m_task.m_in[m_task.m_in_cur].reset();
+        return out.led_status;
+    }
+
+  private:
+    sclx_task& m_task;
+    int m_slave;
+    std::uint32_t m_game_time_sf = 50000;
+    bool m_green_red = false;
+
+    void read_all(char* data, std::size_t len) {
+        while (len > 0) {
+            ssize_t bytes = ::read(m_slave, data, len);
+            if (bytes <= 0) {
+                throw tasks::tasks_exception(tasks::tasks_error::UNSET, "reading from the pty slave failed");
+            }
+            data += bytes;
+            len -= bytes;
+        }
+    }
+};
+
+int main() {
+    try {
+        // the race engine hands events to tasks::exec
+        tasks::dispatcher::init_workers(1);
+        auto disp = tasks::dispatcher::instance();
+        disp->start();
+
+        sclx_task task("pty");
+        task.on_reaction([](std::uint8_t carid, std::int64_t reaction_time, bool jump_start) {
+            std::lock_guard<std::mutex> lock(mtx);
+            reactions[carid] = {reaction_time, jump_start};
+            cond.notify_all();
+        });
+        sclx_task_test powerbase(task);
+
+        powerbase.cycle(0, 0);
+        task.game_init(3, {1, 2});
+        // the countdown lights, the powerbase restarts its clock
+        for (int i = 0; i < 5; i++) {
+            powerbase.cycle(0, 0);
+        }
+        // car 2 jumps the start, 3 cycles before the last packet ahead of the green light
+        powerbase.cycle(0, 20);
+        powerbase.cycle(0, 20);
+        powerbase.cycle(0, 20);
+        task.game_start();
+        std::uint8_t leds = powerbase.cycle(0, 20);
+        check((leds & (sclx::LED_GREEN | sclx::LED_RED)) == (sclx::LED_GREEN | sclx::LED_RED), "GREEN+RED frame");
+        leds = powerbase.cycle(0, 20);
+        check((leds & (sclx::LED_GREEN | sclx::LED_RED)) == sclx::LED_GREEN, "GREEN frame");
+        check(task.game_state() == sclx_task::game_state_t::RACE, "race started with the green light");
+        // car 1 reacts 3 cycles after the green light, on the restarted clock
+        powerbase.cycle(0, 20);
+        powerbase.cycle(30, 20);
+        powerbase.cycle(30, 20);
+
+        std::unique_lock<std::mutex> lock(mtx);
+        cond.wait_for(lock, std::chrono::seconds(2), [] { return reactions.size() == 2; });
+        check(reactions.size() == 2, "two reactions");
+        if (reactions.count(1)) {
+            check(reactions[1].reaction_time == 3 * CYCLE_US, "car 1 reaction time " +
+                                                                  std::to_string(reactions[1].reaction_time));
+            check(!reactions[1].jump_start, "car 1 is no jump start");
+        }
+        if (reactions.count(2)) {
+            check(reactions[2].reaction_time == -3 * CYCLE_US, "car 2 reaction time " +
+                                                                   std::to_string(reactions[2].reaction_time));
+            check(reactions[2].jump_start, "car 2 jump start");
+        }
+        lock.unlock();
+
+        disp->terminate();
+        disp->join();
+    } catch (tasks::tasks_exception& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
+    if (failures > 0) {
+        return 1;
+    }
+    std::cout << "ok" << std::endl;
+    return 0;
+}
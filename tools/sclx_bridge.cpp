@@ -0,0 +1,148 @@
+// Tiny forwarder for the machine wired to the powerbase. It relays the raw powerbase frames between the serial
+// port and a single TCP client, so the race control (sclx tcp://<host>:<port>) can run on a different host.
+// Optionally everything the powerbase sends is written to a recording file (input for sclx_bench).
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+//#define _WITH_PUT_TIME
+#define _WITH_SHORT_LOG
+#include <tasks/logging.h>
+
+#include "../sclx_transport.h"
+
+namespace {
+
+int listen_on(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// write a complete buffer, a full socket/tty is waited for but a peer that takes nothing for a second is given up
+bool write_all(int fd, const char* data, ssize_t len) {
+    while (len > 0) {
+        ssize_t bytes = ::write(fd, data, len);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct pollfd pfd = {fd, POLLOUT, 0};
+                int rc = poll(&pfd, 1, 1000);
+                if (rc > 0 || (rc < 0 && errno == EINTR)) {
+                    continue;
+                }
+                return false;
+            }
+            return false;
+        }
+        data += bytes;
+        len -= bytes;
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <serial device> [tcp port] [recording]" << std::endl;
+        return 1;
+    }
+    int port = argc > 2 ? std::atoi(argv[2]) : 8384;
+    std::ofstream recording;
+    if (argc > 3) {
+        recording.open(argv[3], std::ios::binary | std::ios::trunc);
+    }
+
+    try {
+        sclx_serial_transport serial(argv[1]);
+        serial.open();
+
+        int srv = listen_on(port);
+        if (srv < 0) {
+            terr("sclx_bridge: listening on port " << port << " failed: " << std::strerror(errno) << std::endl);
+            return 1;
+        }
+        terr("sclx_bridge: forwarding " << serial.name() << " on port " << port << std::endl);
+
+        int client = -1;
+        char buf[256];
+        for (;;) {
+            struct pollfd fds[3] = {{srv, POLLIN, 0}, {serial.fd(), POLLIN, 0}, {client, POLLIN, 0}};
+            if (poll(fds, client > -1 ? 3 : 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            if (fds[0].revents & POLLIN) {
+                // a new host replaces the current one
+                int fd = accept(srv, nullptr, nullptr);
+                if (fd > -1) {
+                    if (client > -1) {
+                        ::close(client);
+                    }
+                    client = fd;
+                    int one = 1;
+                    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    terr("sclx_bridge: host connected" << std::endl);
+                    continue;
+                }
+            }
+            if (fds[1].revents & POLLIN) {
+                std::streamsize bytes = serial.read(buf, sizeof(buf));
+                if (bytes < 0) {
+                    terr("sclx_bridge: serial read failed: " << std::strerror(errno) << std::endl);
+                    break;
+                }
+                if (recording.is_open() && bytes > 0) {
+                    recording.write(buf, bytes);
+                }
+                // without a host the powerbase data is dropped
+                if (client > -1 && bytes > 0 && !write_all(client, buf, bytes)) {
+                    ::close(client);
+                    client = -1;
+                }
+            }
+            if (client > -1 && (fds[2].revents & (POLLIN | POLLHUP | POLLERR))) {
+                ssize_t bytes = ::read(client, buf, sizeof(buf));
+                if (bytes <= 0) {
+                    terr("sclx_bridge: host disconnected" << std::endl);
+                    ::close(client);
+                    client = -1;
+                } else if (!write_all(serial.fd(), buf, bytes)) {
+                    terr("sclx_bridge: serial write failed: " << std::strerror(errno) << std::endl);
+                    break;
+                }
+            }
+        }
+    } catch (tasks::tasks_exception& e) {
+        terr("error: " << e.what() << std::endl);
+    }
+
+    return 1;
+}
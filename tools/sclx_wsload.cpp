@@ -0,0 +1,764 @@
+// Load generator for the websocket server. It opens many connections to the /sclx endpoint and measures how the
+// broadcasts of a race spread over them: the fan-out latency (time from the first client receiving a broadcast to
+// each of the others receiving it), the throughput and, with -p, the round trip of a latency request. A share of the
+// connections can read slowly, others drop and reconnect, to put the send queues of the server under pressure. Drive
+// races meanwhile, e.g. with sclx pty and a powerbase simulator or replay. The result is printed as one JSON line
+// like the sclx_bench results.
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <zlib.h>
+
+//#define _WITH_PUT_TIME
+#define _WITH_SHORT_LOG
+#include <tasks/logging.h>
+
+#include "../sclx_histogram.h"
+
+namespace {
+
+struct options_t {
+    std::string host = "127.0.0.1";
+    std::string port = "8383";
+    std::string path = "/sclx";
+    int connections = 1000;
+    int threads = 1;
+    double duration = 30;
+    // share of slow readers and their read rate in bytes per second
+    double slow = 0;
+    std::size_t slow_rate = 2048;
+    // connections that drop and reconnect per second
+    double reconnect = 0;
+    // interval of the latency requests of every connection in ms, 0 for none
+    int probe_ms = 0;
+    bool deflate = false;
+    std::string subscribe;
+};
+
+std::atomic<bool> measuring(false);
+std::atomic<bool> stopping(false);
+
+inline std::uint64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+inline std::uint64_t fnv1a(const std::string& data) {
+    std::uint64_t hash = UINT64_C(14695981039346656037);
+    for (unsigned char c : data) {
+        hash = (hash ^ c) * UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+// First arrival of every broadcast, keyed by the hash of the payload. Entries expire after EXPIRE_US, a payload
+// that comes again later counts as a new broadcast.
+class broadcast_table {
+  public:
+    static constexpr std::uint64_t EXPIRE_US = 10000000;
+    static constexpr std::size_t SHARDS = 64;
+
+    // returns false for the first arrival, else the delay to the first arrival
+    bool arrive(std::uint64_t hash, std::uint64_t now, std::uint64_t& delay) {
+        shard_t& shard = m_shards[hash % SHARDS];
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        auto res = shard.first.emplace(hash, now);
+        if (!res.second && now - res.first->second <= EXPIRE_US) {
+            delay = now - res.first->second;
+            return true;
+        }
+        res.first->second = now;
+        m_broadcasts.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void expire(std::uint64_t now) {
+        for (auto& shard : m_shards) {
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            for (auto it = shard.first.begin(); it != shard.first.end();) {
+                if (now - it->second > EXPIRE_US) {
+                    it = shard.first.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+
+    inline std::uint64_t broadcasts() const { return m_broadcasts.load(std::memory_order_relaxed); }
+
+  private:
+    struct shard_t {
+        std::mutex mtx;
+        std::unordered_map<std::uint64_t, std::uint64_t> first;
+    };
+    shard_t m_shards[SHARDS];
+    std::atomic<std::uint64_t> m_broadcasts{0};
+};
+
+struct stats_t {
+    sclx_histogram fanout;   // us after the first client got the broadcast
+    sclx_histogram rtt;      // latency request round trip in us
+    sclx_histogram connect;  // tcp connect and handshake in us
+    std::atomic<std::uint64_t> messages{0};  // broadcasts received
+    std::atomic<std::uint64_t> bytes{0};     // on the wire
+    std::atomic<std::uint64_t> open{0};
+    std::atomic<std::uint64_t> reconnects{0};
+    std::atomic<std::uint64_t> disconnects{0};
+    std::atomic<std::uint64_t> errors{0};
+};
+
+// One epoll loop for a slice of the connections
+class worker {
+  public:
+    // connections waiting for the handshake at the same time, more only overflow the listen backlog
+    static constexpr int MAX_CONNECTING = 64;
+    static constexpr std::uint64_t TICK_US = 10000;
+    static constexpr std::uint64_t SLOW_READ_US = 100000;
+
+    stats_t stats;
+
+    worker(const options_t& opt, const struct addrinfo* addr, broadcast_table& table, int first, int count)
+        : m_opt(opt), m_addr(addr), m_table(table), m_conns(count), m_rng(UINT64_C(0x9e3779b97f4a7c15) * (first + 1)) {
+        for (int i = 0; i < count; i++) {
+            // spread the slow readers evenly
+            int n = first + i;
+            m_conns[i].slow = static_cast<int>((n + 1) * opt.slow) > static_cast<int>(n * opt.slow);
+        }
+        m_epoll = epoll_create1(0);
+    }
+
+    ~worker() {
+        for (auto& c : m_conns) {
+            close_conn(c);
+        }
+        ::close(m_epoll);
+    }
+
+    worker(const worker&) = delete;
+    worker& operator=(const worker&) = delete;
+
+    void run() {
+        std::vector<struct epoll_event> events(256);
+        std::uint64_t next_tick = 0;
+        while (!stopping) {
+            int n = epoll_wait(m_epoll, events.data(), events.size(), TICK_US / 1000);
+            std::uint64_t now = now_us();
+            for (int i = 0; i < n; i++) {
+                conn_t& c = m_conns[events[i].data.u32];
+                if (c.state == state_t::CONNECTING) {
+                    on_connected(c, now);
+                } else if (c.fd > -1) {
+                    on_readable(c, now);
+                }
+            }
+            if (now >= next_tick) {
+                tick(now, next_tick ? now - next_tick + TICK_US : 0);
+                next_tick = now + TICK_US;
+            }
+        }
+    }
+
+  private:
+    enum class state_t { IDLE, CONNECTING, HANDSHAKE, OPEN };
+
+    struct conn_t {
+        int fd = -1;
+        state_t state = state_t::IDLE;
+        bool slow = false;
+        std::vector<char> in;
+        std::size_t in_pos = 0;
+        std::string message;
+        bool message_compressed = false;
+        bool inflating = false;
+        z_stream inflater;  // must not move, zlib keeps a pointer to it
+        std::uint64_t started = 0;
+        std::uint64_t next_connect = 0;
+        std::uint64_t next_read = 0;
+        bool armed = false;
+        std::uint64_t probe_sent = 0;
+        std::uint64_t next_probe = 0;
+    };
+
+    const options_t& m_opt;
+    const struct addrinfo* m_addr;
+    broadcast_table& m_table;
+    std::vector<conn_t> m_conns;
+    int m_epoll;
+    int m_connecting = 0;
+    double m_churn = 0;
+    std::uint64_t m_rng;
+    std::string m_inflated;
+
+    inline std::uint64_t next_random() {
+        m_rng ^= m_rng << 13;
+        m_rng ^= m_rng >> 7;
+        m_rng ^= m_rng << 17;
+        return m_rng;
+    }
+
+    inline std::uint32_t index(const conn_t& c) const { return static_cast<std::uint32_t>(&c - m_conns.data()); }
+
+    void watch(conn_t& c, std::uint32_t events, int op) {
+        struct epoll_event ev;
+        std::memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.u32 = index(c);
+        epoll_ctl(m_epoll, op, c.fd, &ev);
+    }
+
+    void start_connect(conn_t& c, std::uint64_t now) {
+        c.fd = socket(m_addr->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (c.fd < 0) {
+            stats.errors++;
+            c.next_connect = now + 1000000;
+            return;
+        }
+        int one = 1;
+        setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (c.slow) {
+            // a small receive window pushes the backlog of a slow reader into the send queue of the server
+            int size = 4096;
+            setsockopt(c.fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        }
+        c.started = now;
+        c.state = state_t::CONNECTING;
+        m_connecting++;
+        if (connect(c.fd, m_addr->ai_addr, m_addr->ai_addrlen) < 0 && errno != EINPROGRESS) {
+            fail(c, now);
+            return;
+        }
+        watch(c, EPOLLOUT, EPOLL_CTL_ADD);
+    }
+
+    void on_connected(conn_t& c, std::uint64_t now) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+            fail(c, now);
+            return;
+        }
+        // the server does not check the key beyond its presence
+        char key[25];
+        std::snprintf(key, sizeof(key), "%016" PRIx64 "%06" PRIx64 "==", next_random(), next_random() & 0xffffff);
+        std::string req = "GET " + m_opt.path + " HTTP/1.1\r\nHost: " + m_opt.host + ":" + m_opt.port +
+                          "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: " + key +
+                          "\r\nSec-WebSocket-Version: 13\r\n";
+        if (m_opt.deflate) {
+            req += "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n";
+        }
+        req += "\r\n";
+        if (!write_all(c.fd, req.data(), req.size())) {
+            fail(c, now);
+            return;
+        }
+        c.state = state_t::HANDSHAKE;
+        watch(c, EPOLLIN, EPOLL_CTL_MOD);
+    }
+
+    void on_readable(conn_t& c, std::uint64_t now) {
+        bool slow = c.slow && c.state == state_t::OPEN;
+        std::size_t budget = slow ? std::max<std::size_t>(m_opt.slow_rate * SLOW_READ_US / 1000000, 1) : 65536;
+        char buf[16384];
+        while (budget > 0) {
+            ssize_t bytes = ::read(c.fd, buf, std::min(sizeof(buf), budget));
+            if (bytes > 0) {
+                c.in.insert(c.in.end(), buf, buf + bytes);
+                budget -= bytes;
+                if (measuring) {
+                    stats.bytes += bytes;
+                }
+            } else if (bytes < 0 && errno == EINTR) {
+                continue;
+            } else if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                lost(c, now);
+                return;
+            }
+        }
+        if (!process(c, now)) {
+            return;
+        }
+        if (slow) {
+            c.armed = false;
+            c.next_read = now + SLOW_READ_US;
+        }
+    }
+
+    // returns false if the connection was closed
+    bool process(conn_t& c, std::uint64_t now) {
+        if (c.state == state_t::HANDSHAKE) {
+            static const char end[] = "\r\n\r\n";
+            auto it = std::search(c.in.begin(), c.in.end(), end, end + 4);
+            if (it == c.in.end()) {
+                if (c.in.size() > 8192) {
+                    fail(c, now);
+                    return false;
+                }
+                return true;
+            }
+            std::string header(c.in.begin(), it);
+            c.in_pos = it - c.in.begin() + 4;
+            if (header.compare(0, 12, "HTTP/1.1 101") != 0) {
+                terr("sclx_wsload: handshake failed: " << header.substr(0, header.find('\r')) << std::endl);
+                fail(c, now);
+                return false;
+            }
+            if (m_opt.deflate && header.find("permessage-deflate") != std::string::npos) {
+                std::memset(&c.inflater, 0, sizeof(c.inflater));
+                c.inflating = inflateInit2(&c.inflater, -15) == Z_OK;
+            }
+            c.state = state_t::OPEN;
+            m_connecting--;
+            stats.open++;
+            stats.connect.record(now - c.started);
+            if (!m_opt.subscribe.empty() && !send_frame(c, 1, m_opt.subscribe)) {
+                lost(c, now);
+                return false;
+            }
+            if (m_opt.probe_ms > 0) {
+                c.next_probe = now + next_random() % (m_opt.probe_ms * UINT64_C(1000));
+            }
+            if (c.slow) {
+                c.armed = true;
+                watch(c, EPOLLIN | EPOLLONESHOT, EPOLL_CTL_MOD);
+            }
+        }
+        while (c.state == state_t::OPEN) {
+            std::size_t avail = c.in.size() - c.in_pos;
+            const unsigned char* p = reinterpret_cast<const unsigned char*>(c.in.data()) + c.in_pos;
+            if (avail < 2) {
+                break;
+            }
+            std::uint64_t length = p[1] & 127;
+            std::size_t header = 2;
+            if (length == 126) {
+                if (avail < 4) {
+                    break;
+                }
+                length = (p[2] << 8) | p[3];
+                header = 4;
+            } else if (length == 127) {
+                if (avail < 10) {
+                    break;
+                }
+                length = 0;
+                for (int i = 2; i < 10; i++) {
+                    length = (length << 8) | p[i];
+                }
+                header = 10;
+            }
+            // the server never masks
+            if ((p[1] & 128) || length > (64u << 20)) {
+                lost(c, now);
+                return false;
+            }
+            if (avail < header + length) {
+                break;
+            }
+            unsigned char opcode = p[0] & 15;
+            bool fin = p[0] & 128;
+            const char* payload = reinterpret_cast<const char*>(p + header);
+            c.in_pos += header + length;
+            if (opcode == 8) {
+                lost(c, now);
+                return false;
+            } else if (opcode == 9) {
+                if (!send_frame(c, 10, std::string(payload, length))) {
+                    lost(c, now);
+                    return false;
+                }
+            } else if (opcode < 3) {
+                if (opcode != 0) {
+                    c.message.clear();
+                    c.message_compressed = p[0] & 64;
+                }
+                c.message.append(payload, length);
+                if (fin && !deliver(c, now)) {
+                    lost(c, now);
+                    return false;
+                }
+            }
+        }
+        if (c.in_pos == c.in.size()) {
+            c.in.clear();
+            c.in_pos = 0;
+        } else if (c.in_pos > 65536) {
+            c.in.erase(c.in.begin(), c.in.begin() + c.in_pos);
+            c.in_pos = 0;
+        }
+        return true;
+    }
+
+    bool deliver(conn_t& c, std::uint64_t now) {
+        const std::string* data = &c.message;
+        if (c.message_compressed) {
+            if (!c.inflating) {
+                return false;
+            }
+            c.message.append("\x00\x00\xff\xff", 4);
+            m_inflated.clear();
+            c.inflater.next_in = reinterpret_cast<Bytef*>(&c.message[0]);
+            c.inflater.avail_in = c.message.size();
+            char buf[16384];
+            int ret;
+            do {
+                c.inflater.next_out = reinterpret_cast<Bytef*>(buf);
+                c.inflater.avail_out = sizeof(buf);
+                ret = inflate(&c.inflater, Z_SYNC_FLUSH);
+                if ((ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) ||
+                    (ret == Z_BUF_ERROR && c.inflater.avail_out == sizeof(buf))) {
+                    return false;
+                }
+                m_inflated.append(buf, sizeof(buf) - c.inflater.avail_out);
+                if (ret == Z_STREAM_END) {
+                    inflateReset(&c.inflater);
+                }
+            } while (c.inflater.avail_in > 0 || c.inflater.avail_out == 0);
+            data = &m_inflated;
+        }
+        if (c.probe_sent && data->find("\"type\":\"latency\"") != std::string::npos) {
+            if (measuring) {
+                stats.rtt.record(now - c.probe_sent);
+            }
+            c.probe_sent = 0;
+            c.next_probe = now + m_opt.probe_ms * UINT64_C(1000);
+            return true;
+        }
+        std::uint64_t delay;
+        bool later = m_table.arrive(fnv1a(*data), now, delay);
+        if (measuring) {
+            stats.messages++;
+            if (later) {
+                stats.fanout.record(delay);
+            }
+        }
+        return true;
+    }
+
+    void tick(std::uint64_t now, std::uint64_t elapsed) {
+        for (auto& c : m_conns) {
+            if (c.state == state_t::IDLE) {
+                if (c.next_connect <= now && m_connecting < MAX_CONNECTING) {
+                    start_connect(c, now);
+                }
+            } else if (c.state == state_t::OPEN) {
+                if (c.slow && !c.armed && c.next_read <= now) {
+                    c.armed = true;
+                    watch(c, EPOLLIN | EPOLLONESHOT, EPOLL_CTL_MOD);
+                }
+                if (m_opt.probe_ms > 0 && !c.probe_sent && c.next_probe <= now) {
+                    if (!send_frame(c, 1, "{\"type\":\"latency\"}")) {
+                        lost(c, now);
+                        continue;
+                    }
+                    c.probe_sent = now;
+                }
+            }
+        }
+        // drop random connections at the configured rate, alternately with and without a close frame
+        m_churn += m_opt.reconnect * m_conns.size() / m_opt.connections * elapsed / 1000000.;
+        for (int tries = 0; m_churn >= 1 && tries < 100; tries++) {
+            conn_t& c = m_conns[next_random() % m_conns.size()];
+            if (c.state != state_t::OPEN) {
+                continue;
+            }
+            if (next_random() & 1) {
+                send_frame(c, 8, std::string("\x03\xe8", 2));
+            }
+            close_conn(c);
+            stats.reconnects++;
+            c.next_connect = now;
+            m_churn -= 1;
+        }
+    }
+
+    // connecting failed, try again later
+    void fail(conn_t& c, std::uint64_t now) {
+        stats.errors++;
+        close_conn(c);
+        c.next_connect = now + 1000000;
+    }
+
+    // the server closed an open connection
+    void lost(conn_t& c, std::uint64_t now) {
+        if (c.state != state_t::OPEN) {
+            fail(c, now);
+            return;
+        }
+        if (measuring) {
+            stats.disconnects++;
+        }
+        close_conn(c);
+        c.next_connect = now + 100000;
+    }
+
+    void close_conn(conn_t& c) {
+        if (c.fd > -1) {
+            ::close(c.fd);
+            c.fd = -1;
+        }
+        if (c.state == state_t::OPEN) {
+            stats.open--;
+        } else if (c.state != state_t::IDLE) {
+            m_connecting--;
+        }
+        if (c.inflating) {
+            inflateEnd(&c.inflater);
+            c.inflating = false;
+        }
+        c.state = state_t::IDLE;
+        c.in.clear();
+        c.in_pos = 0;
+        c.message.clear();
+        c.probe_sent = 0;
+    }
+
+    // client frames are masked
+    bool send_frame(conn_t& c, unsigned char opcode, const std::string& payload) {
+        std::string frame;
+        frame += static_cast<char>(128 | opcode);
+        if (payload.size() < 126) {
+            frame += static_cast<char>(128 | payload.size());
+        } else {
+            frame += static_cast<char>(128 | 126);
+            frame += static_cast<char>(payload.size() >> 8);
+            frame += static_cast<char>(payload.size() & 255);
+        }
+        std::uint32_t mask = next_random();
+        char mask_bytes[4];
+        std::memcpy(mask_bytes, &mask, 4);
+        frame.append(mask_bytes, 4);
+        for (std::size_t i = 0; i < payload.size(); i++) {
+            frame += payload[i] ^ mask_bytes[i % 4];
+        }
+        return write_all(c.fd, frame.data(), frame.size());
+    }
+
+    // the client frames are tiny, wait for the socket if it is full anyway
+    static bool write_all(int fd, const char* data, std::size_t len) {
+        while (len > 0) {
+            ssize_t bytes = ::send(fd, data, len, MSG_NOSIGNAL);
+            if (bytes < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                struct pollfd pfd = {fd, POLLOUT, 0};
+                if ((errno == EAGAIN || errno == EWOULDBLOCK) && poll(&pfd, 1, 100) > 0) {
+                    continue;
+                }
+                return false;
+            }
+            data += bytes;
+            len -= bytes;
+        }
+        return true;
+    }
+};
+
+void usage(const char* name) {
+    std::cerr << "Usage: " << name << " [options] [ws://<host>:<port>/<path>]" << std::endl
+              << "  -n <count>  connections (1000)" << std::endl
+              << "  -t <count>  threads (1)" << std::endl
+              << "  -d <s>      measured duration after all connections are open (30)" << std::endl
+              << "  -s <share>  share of slow readers, e.g. 0.1 (0)" << std::endl
+              << "  -b <bytes>  read rate of a slow reader per second (2048)" << std::endl
+              << "  -r <count>  connections that drop and reconnect per second (0)" << std::endl
+              << "  -p <ms>     send a latency request on every connection at this interval (off)" << std::endl
+              << "  -z          offer permessage-deflate" << std::endl
+              << "  -S <json>   send this message after connecting, e.g. a subscription" << std::endl;
+}
+
+bool parse_url(const std::string& url, options_t& opt) {
+    if (url.compare(0, 5, "ws://") != 0) {
+        return false;
+    }
+    std::string rest = url.substr(5);
+    std::size_t slash = rest.find('/');
+    std::string host = rest.substr(0, slash);
+    opt.path = slash == std::string::npos ? "/" : rest.substr(slash);
+    std::size_t colon = host.rfind(':');
+    if (colon != std::string::npos) {
+        opt.port = host.substr(colon + 1);
+        host = host.substr(0, colon);
+    }
+    opt.host = host;
+    return !host.empty();
+}
+
+void merge(std::vector<std::unique_ptr<worker>>& workers, stats_t& total) {
+    for (auto& w : workers) {
+        total.fanout.add(w->stats.fanout);
+        total.rtt.add(w->stats.rtt);
+        total.connect.add(w->stats.connect);
+        total.messages += w->stats.messages;
+        total.bytes += w->stats.bytes;
+        total.open += w->stats.open;
+        total.reconnects += w->stats.reconnects;
+        total.disconnects += w->stats.disconnects;
+        total.errors += w->stats.errors;
+    }
+}
+
+void write_histogram(std::ostream& out, const char* name, const sclx_histogram& h) {
+    out << ",\"" << name << "\":{\"count\":" << h.count() << ",\"mean\":" << h.mean()
+        << ",\"p50\":" << h.percentile(50) << ",\"p99\":" << h.percentile(99)
+        << ",\"p999\":" << h.percentile(99.9) << ",\"max\":" << h.max() << "}";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    options_t opt;
+    int ch;
+    while ((ch = getopt(argc, argv, "n:t:d:s:b:r:p:zS:h")) != -1) {
+        switch (ch) {
+            case 'n':
+                opt.connections = std::atoi(optarg);
+                break;
+            case 't':
+                opt.threads = std::atoi(optarg);
+                break;
+            case 'd':
+                opt.duration = std::atof(optarg);
+                break;
+            case 's':
+                opt.slow = std::atof(optarg);
+                break;
+            case 'b':
+                opt.slow_rate = std::atoi(optarg);
+                break;
+            case 'r':
+                opt.reconnect = std::atof(optarg);
+                break;
+            case 'p':
+                opt.probe_ms = std::atoi(optarg);
+                break;
+            case 'z':
+                opt.deflate = true;
+                break;
+            case 'S':
+                opt.subscribe = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if ((optind < argc && !parse_url(argv[optind], opt)) || opt.connections < 1 || opt.threads < 1 ||
+        opt.slow < 0 || opt.slow > 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    opt.threads = std::min(opt.threads, opt.connections);
+
+    signal(SIGPIPE, SIG_IGN);
+    // every connection needs a file descriptor
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addr = nullptr;
+    int err = getaddrinfo(opt.host.c_str(), opt.port.c_str(), &hints, &addr);
+    if (err != 0) {
+        terr("sclx_wsload: " << opt.host << ": " << gai_strerror(err) << std::endl);
+        return 1;
+    }
+
+    broadcast_table table;
+    std::vector<std::unique_ptr<worker>> workers;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < opt.threads; i++) {
+        int first = opt.connections * i / opt.threads;
+        int count = opt.connections * (i + 1) / opt.threads - first;
+        workers.emplace_back(new worker(opt, addr, table, first, count));
+    }
+    for (auto& w : workers) {
+        threads.emplace_back([&w] { w->run(); });
+    }
+
+    auto open = [&workers] {
+        std::uint64_t n = 0;
+        for (auto& w : workers) {
+            n += w->stats.open;
+        }
+        return n;
+    };
+    std::uint64_t begin = now_us();
+    while (open() < static_cast<std::uint64_t>(opt.connections) && now_us() - begin < 30000000) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    terr("sclx_wsload: " << open() << " connections open after " << (now_us() - begin) / 1000 << "ms" << std::endl);
+
+    measuring = true;
+    std::uint64_t start = now_us();
+    std::uint64_t broadcasts = table.broadcasts();
+    std::uint64_t last_messages = 0;
+    for (int second = 1; now_us() - start < opt.duration * 1000000; second++) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        table.expire(now_us());
+        stats_t total;
+        merge(workers, total);
+        terr("sclx_wsload: " << second << "s open " << total.open << " messages/s " << total.messages - last_messages
+                             << " fan-out p99 " << total.fanout.percentile(99) << "us" << std::endl);
+        last_messages = total.messages;
+    }
+    measuring = false;
+    double seconds = (now_us() - start) / 1e6;
+    broadcasts = table.broadcasts() - broadcasts;
+    stopping = true;
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    stats_t total;
+    merge(workers, total);
+    workers.clear();
+    freeaddrinfo(addr);
+
+    std::cout << "{\"name\":\"wsload\",\"connections\":" << opt.connections
+              << ",\"slow\":" << static_cast<int>(opt.connections * opt.slow) << ",\"threads\":" << opt.threads
+              << ",\"deflate\":" << (opt.deflate ? "true" : "false") << ",\"seconds\":" << seconds
+              << ",\"broadcasts\":" << broadcasts << ",\"messages\":" << total.messages
+              << ",\"messages_per_s\":" << total.messages / seconds << ",\"bytes_per_s\":" << total.bytes / seconds
+              << ",\"delivered\":"
+              << (broadcasts > 0 ? static_cast<double>(total.messages) / (broadcasts * opt.connections) : 0.);
+    write_histogram(std::cout, "fanout_us", total.fanout);
+    write_histogram(std::cout, "rtt_us", total.rtt);
+    write_histogram(std::cout, "connect_us", total.connect);
+    std::cout << ",\"reconnects\":" << total.reconnects << ",\"disconnects\":" << total.disconnects
+              << ",\"errors\":" << total.errors << "}" << std::endl;
+    return 0;
+}
@@ -0,0 +1,240 @@
+#ifndef DEFLATE_HPP
+#define	DEFLATE_HPP
+
+#include <boost/asio/streambuf.hpp>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+namespace SimpleWeb {
+    //permessage-deflate, see http://tools.ietf.org/html/rfc7692
+    namespace Deflate {
+        //Server side settings
+        struct Options {
+            bool enabled=false;
+            //Messages below this size are sent uncompressed, the frame overhead eats the gain
+            size_t min_length=64;
+            int level=Z_BEST_SPEED;
+            //The window and memory level of the compressor, each connection needs about
+            //(1<<(window_bits+2))+(1<<(mem_level+9)) bytes
+            int window_bits=15;
+            int mem_level=8;
+            //Keep the compressor state from one message to the next, costs the memory above for every connection
+            //but the repeated keys of the json messages shrink to a few bytes
+            bool context_takeover=true;
+            //Upper limit for a decompressed client message
+            size_t max_message_length=1<<20;
+        };
+
+        //Outcome of the handshake for one connection
+        struct Params {
+            bool server_no_context_takeover=false;
+            int server_max_window_bits=0; //0: not offered by the client
+        };
+
+        namespace detail {
+            inline std::string trim(const std::string& str) {
+                size_t begin=str.find_first_not_of(" \t");
+                if(begin==std::string::npos)
+                    return std::string();
+                size_t end=str.find_last_not_of(" \t");
+                return str.substr(begin, end-begin+1);
+            }
+
+            //Window bits parameter value, -1 if invalid
+            inline int window_bits(std::string value) {
+                if(value.size()>=2 && value.front()=='"' && value.back()=='"')
+                    value=value.substr(1, value.size()-2);
+                if(value.empty() || value.size()>2 || value.find_first_not_of("0123456789")!=std::string::npos)
+                    return -1;
+                int bits=std::stoi(value);
+                return bits>=8 && bits<=15?bits:-1;
+            }
+
+            inline bool accept_offer(const std::string& offer, const Options& options, Params& params) {
+                params=Params();
+                params.server_no_context_takeover=!options.context_takeover;
+                bool seen_server_nct=false, seen_client_nct=false, seen_server_bits=false, seen_client_bits=false;
+                size_t pos=offer.find(';');
+                if(trim(offer.substr(0, pos))!="permessage-deflate")
+                    return false;
+                while(pos!=std::string::npos) {
+                    size_t next=offer.find(';', pos+1);
+                    std::string param=trim(offer.substr(pos+1, next==std::string::npos?std::string::npos:next-pos-1));
+                    pos=next;
+                    size_t eq=param.find('=');
+                    std::string name=trim(param.substr(0, eq));
+                    std::string value=eq==std::string::npos?std::string():trim(param.substr(eq+1));
+                    if(name=="server_no_context_takeover" && !seen_server_nct && eq==std::string::npos) {
+                        seen_server_nct=true;
+                        params.server_no_context_takeover=true;
+                    }
+                    else if(name=="client_no_context_takeover" && !seen_client_nct && eq==std::string::npos) {
+                        //The decompressor copes with both
+                        seen_client_nct=true;
+                    }
+                    else if(name=="server_max_window_bits" && !seen_server_bits) {
+                        seen_server_bits=true;
+                        //zlib can not compress with a 256 byte window, decline the offer then
+                        int bits=window_bits(value);
+                        if(bits<9)
+                            return false;
+                        params.server_max_window_bits=bits<options.window_bits?bits:options.window_bits;
+                    }
+                    else if(name=="client_max_window_bits" && !seen_client_bits) {
+                        //The decompressor always uses the largest window, so the value is not answered
+                        seen_client_bits=true;
+                        if(eq!=std::string::npos && window_bits(value)<0)
+                            return false;
+                    }
+                    else
+                        return false;
+                }
+                return true;
+            }
+        }
+
+        //Pick the first acceptable offer of a Sec-WebSocket-Extensions header, returns false if there is none
+        inline bool negotiate(const std::string& extensions, const Options& options, Params& params) {
+            size_t begin=0;
+            while(begin<=extensions.size()) {
+                size_t end=extensions.find(',', begin);
+                if(end==std::string::npos)
+                    end=extensions.size();
+                if(detail::accept_offer(extensions.substr(begin, end-begin), options, params))
+                    return true;
+                begin=end+1;
+            }
+            return false;
+        }
+
+        //The Sec-WebSocket-Extensions value of the handshake response
+        inline std::string response(const Params& params) {
+            std::string value="permessage-deflate";
+            if(params.server_no_context_takeover)
+                value+="; server_no_context_takeover";
+            if(params.server_max_window_bits>0)
+                value+="; server_max_window_bits="+std::to_string(params.server_max_window_bits);
+            return value;
+        }
+
+        //Compressor for the messages sent on one connection, the zlib state is allocated with the first message
+        class Compressor {
+        public:
+            Compressor(const Options& options, const Params& params): initialized(false), level(options.level),
+                    window_bits(params.server_max_window_bits>0?params.server_max_window_bits:options.window_bits),
+                    mem_level(options.mem_level), context_takeover(!params.server_no_context_takeover) {}
+            ~Compressor() {
+                if(initialized)
+                    deflateEnd(&stream);
+            }
+            Compressor(const Compressor&)=delete;
+            Compressor& operator=(const Compressor&)=delete;
+
+            //Compress one message into out, returns false on a zlib error, the compressor is unusable then
+            bool compress(const char* data, size_t length, std::string& out) {
+                if(!initialized) {
+                    std::memset(&stream, 0, sizeof(stream));
+                    //Negative window bits: raw deflate without zlib header and checksum
+                    if(deflateInit2(&stream, level, Z_DEFLATED, -window_bits, mem_level, Z_DEFAULT_STRATEGY)!=Z_OK)
+                        return false;
+                    initialized=true;
+                }
+                stream.next_in=reinterpret_cast<Bytef*>(const_cast<char*>(data));
+                stream.avail_in=length;
+                out.resize(deflateBound(&stream, length)+6);
+                size_t out_length=0;
+                for(;;) {
+                    stream.next_out=reinterpret_cast<Bytef*>(&out[out_length]);
+                    stream.avail_out=out.size()-out_length;
+                    int ret=deflate(&stream, Z_SYNC_FLUSH);
+                    out_length=out.size()-stream.avail_out;
+                    if(ret!=Z_OK && ret!=Z_BUF_ERROR)
+                        return false;
+                    //Done when the flush did not fill the output buffer
+                    if(stream.avail_out>0)
+                        break;
+                    out.resize(out.size()*2);
+                }
+                //A sync flush ends with an empty stored block (00 00 ff ff), the receiver appends it again
+                if(out_length<4 || std::memcmp(&out[out_length-4], "\x00\x00\xff\xff", 4)!=0)
+                    return false;
+                out.resize(out_length-4);
+                if(!context_takeover)
+                    deflateReset(&stream);
+                return true;
+            }
+
+        private:
+            z_stream stream;
+            bool initialized;
+            int level;
+            int window_bits;
+            int mem_level;
+            bool context_takeover;
+        };
+
+        //Decompressor for the messages received on one connection. It always keeps the context, a client that
+        //resets its compressor after each message just never refers to the previous ones.
+        class Decompressor {
+        public:
+            Decompressor(): initialized(false) {}
+            ~Decompressor() {
+                if(initialized)
+                    inflateEnd(&stream);
+            }
+            Decompressor(const Decompressor&)=delete;
+            Decompressor& operator=(const Decompressor&)=delete;
+
+            //Buffer for the masked input, reused for every message
+            std::vector<unsigned char> input;
+
+            //Decompress one message from input into out, returns false on corrupt data or if the message is
+            //larger than max_length
+            bool decompress(size_t length, boost::asio::streambuf& out, size_t max_length) {
+                if(!initialized) {
+                    std::memset(&stream, 0, sizeof(stream));
+                    if(inflateInit2(&stream, -15)!=Z_OK)
+                        return false;
+                    initialized=true;
+                }
+                input.resize(length+4);
+                std::memcpy(&input[length], "\x00\x00\xff\xff", 4);
+                stream.next_in=input.data();
+                stream.avail_in=input.size();
+                size_t total=0;
+                for(;;) {
+                    size_t chunk=total<4096?4096:total;
+                    if(total+chunk>max_length+1)
+                        chunk=max_length+1-total;
+                    stream.next_out=boost::asio::buffer_cast<Bytef*>(out.prepare(chunk));
+                    stream.avail_out=chunk;
+                    int ret=inflate(&stream, Z_SYNC_FLUSH);
+                    size_t produced=chunk-stream.avail_out;
+                    out.commit(produced);
+                    total+=produced;
+                    if(total>max_length)
+                        return false;
+                    //The client may end a message with a final block, the next message starts a new stream then
+                    if(ret==Z_STREAM_END)
+                        return inflateReset(&stream)==Z_OK;
+                    if(ret!=Z_OK && ret!=Z_BUF_ERROR)
+                        return false;
+                    //All input consumed and the output was not the limit
+                    if(stream.avail_in==0 && stream.avail_out>0)
+                        return true;
+                    if(ret==Z_BUF_ERROR && stream.avail_out>0)
+                        return false;
+                }
+            }
+
+        private:
+            z_stream stream;
+            bool initialized;
+        };
+    }
+}
+#endif	/* DEFLATE_HPP */
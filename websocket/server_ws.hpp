@@ -5,18 +5,38 @@
 #define	SERVER_WS_HPP
 
 #include "crypto.hpp"
+#include "deflate.hpp"
 
 #include <boost/asio.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iterator>
 #include <regex>
 #include <unordered_map>
 #include <thread>
 #include <mutex>
 #include <set>
 #include <memory>
+#include <vector>
 
 #include <iostream>
 
+#include <cerrno>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 namespace SimpleWeb {
     template <class socket_type>
     class SocketServer;
@@ -38,15 +58,62 @@ namespace SimpleWeb {
             boost::asio::ip::address remote_endpoint_address;
             unsigned short remote_endpoint_port;
             
+            size_t send_queue_high_water() const {
+                return send_queue_max.load();
+            }
+            
+            //permessage-deflate was negotiated in the handshake
+            bool compressed() const {
+                return deflate;
+            }
+            
         private:
+            //The io_service of the connection, all its handlers run on the thread of this io_service
+            boost::asio::io_service& io_service;
+            
             //boost::asio::ssl::stream constructor needs move, until then we store socket as unique_ptr
             std::unique_ptr<socket_type> socket;
             
             std::atomic<bool> closed;
 
+            //Request path without the query of a resource request, path_match points into it
+            std::string resource_path;
+
             std::unique_ptr<boost::asio::deadline_timer> timer_idle;
+            
+            //Keepalive, only used on the thread of the connection. pong_pending is cleared by every frame received.
+            std::unique_ptr<boost::asio::deadline_timer> timer_ping;
+            bool pong_pending;
 
-            Connection(socket_type* socket_ptr): socket(socket_ptr), closed(false) {}
+            //Number of frames queued or being written, and its maximum
+            std::atomic<size_t> send_queue;
+            std::atomic<size_t> send_queue_max;
+
+            //Frame header plus a reference to the payload, the payload is shared with the other receivers of a broadcast
+            struct Frame {
+                unsigned char header[10];
+                size_t header_length;
+                std::shared_ptr<const std::string> payload;
+                std::function<void(const boost::system::error_code&)> callback;
+            };
+            
+            //Outgoing frames, the first send_writing frames are being written in one gather write. Elements of a
+            //deque stay in place on push_back, so the buffers of a running write stay valid. send_posted is set while
+            //the start of a write waits for the thread of the connection.
+            std::mutex send_mutex;
+            std::deque<Frame> send_frames;
+            size_t send_writing;
+            bool send_posted;
+            
+            //permessage-deflate state, the compressor is guarded by send_mutex, the decompressor is only used by
+            //the read handler
+            std::unique_ptr<Deflate::Compressor> compressor;
+            std::unique_ptr<Deflate::Decompressor> decompressor;
+            bool deflate;
+
+            Connection(boost::asio::io_service& io_service, socket_type* socket_ptr): io_service(io_service), 
+                    socket(socket_ptr), closed(false), pong_pending(false), send_queue(0), send_queue_max(0), 
+                    send_writing(0), send_posted(false), deflate(false) {}
             
             void read_remote_endpoint_data() {
                 try {
@@ -67,11 +134,52 @@ namespace SimpleWeb {
             size_t length;
             unsigned char fin_rsv_opcode;
             
+            //The payload is kept in one contiguous buffer, this gives direct access to the part not yet read from data
+            const char* begin() const {return boost::asio::buffer_cast<const char*>(data_buffer.data());}
+            const char* end() const {return begin()+data_buffer.size();}
+            
         private:
             Message(): data(&data_buffer) {}
             boost::asio::streambuf data_buffer;
         };
         
+        //Response of a plain HTTP resource. The status line, the headers and a small body are written to the stream,
+        //a large body can follow without a copy: a shared string or a part of an open file, sent with sendfile.
+        class Response : public std::ostream {
+            friend class SocketServerBase<socket_type>;
+            
+        public:
+            //The response has a Content-Length and the connection can take the next request, otherwise it gets
+            //closed after the response
+            bool keep_alive;
+            
+            //Send length bytes of content from offset after the stream
+            void body(std::shared_ptr<const std::string> content, size_t offset=0, size_t length=std::string::npos) {
+                this->content=std::move(content);
+                content_offset=offset;
+                content_length=std::min(length, this->content->size()-offset);
+            }
+            
+            //Send length bytes of an open file from offset after the stream and the body. The descriptor has to stay
+            //open until the response is sent, plain sockets only.
+            void file(int fd, size_t offset, size_t length) {
+                file_fd=fd;
+                file_offset=offset;
+                file_length=length;
+            }
+            
+        private:
+            Response(): std::ostream(&buffer), keep_alive(false), content_offset(0), content_length(0), file_fd(-1),
+                    file_offset(0), file_length(0) {}
+            boost::asio::streambuf buffer;
+            std::shared_ptr<const std::string> content;
+            size_t content_offset;
+            size_t content_length;
+            int file_fd;
+            size_t file_offset;
+            size_t file_length;
+        };
+        
         struct Callbacks {
             std::function<void(std::shared_ptr<Connection>)> onopen;
             std::function<void(std::shared_ptr<Connection>, std::shared_ptr<Message>)> onmessage;
@@ -81,17 +189,45 @@ namespace SimpleWeb {
         
         std::map<std::string, Callbacks> endpoint;        
         
+        //Plain HTTP GET resources for requests without a websocket upgrade. The handler writes the complete
+        //response (status line, headers and body), the connection is closed afterwards unless the handler sets
+        //Response::keep_alive.
+        std::map<std::string, std::function<void(std::shared_ptr<Connection>, Response&)> > resource;
+        
+        //Resources by exact path (without the query), looked up before the regular expressions of resource
+        std::unordered_map<std::string, std::function<void(std::shared_ptr<Connection>, Response&)> > path_resource;
+        
+        //Statistics, updated without locks
+        std::atomic<std::uint64_t> messages_sent;
+        std::atomic<std::uint64_t> bytes_sent;
+        //Payload bytes before and after compression
+        std::atomic<std::uint64_t> deflate_bytes_in;
+        std::atomic<std::uint64_t> deflate_bytes_out;
+        
+        //permessage-deflate is offered to the clients if enabled, set before start()
+        Deflate::Options deflate_options;
+        
+        //Keepalive: every ping_interval seconds a ping is sent, a connection that sends nothing within pong_timeout
+        //seconds after the ping is dropped without a close handshake. Frees the connections of phones that went
+        //away long before TCP notices. 0 disables, pong_timeout 0 means ping_interval, a pong_timeout longer than
+        //ping_interval is cut to ping_interval. Set before start().
+        size_t ping_interval=0;
+        size_t pong_timeout=0;
+        //Connections dropped by the keepalive
+        std::atomic<std::uint64_t> connections_evicted;
+        
         void start() {
             accept();
             
-            //If num_threads>1, start m_io_service.run() in (num_threads-1) threads for thread-pooling
-            for(size_t c=1;c<num_threads;c++) {
-                threads.emplace_back([this](){
-                    asio_io_service.run();
+            //The other io_services have no work until the first connection comes in
+            for(auto& io_service: connection_io_services) {
+                threads.emplace_back([&io_service](){
+                    boost::asio::io_service::work work(*io_service);
+                    io_service->run();
                 });
             }
 
-            //Main thread
+            //Main thread, runs the acceptor as well
             asio_io_service.run();
 
             //Wait for the rest of the threads, if any, to finish as well
@@ -102,52 +238,122 @@ namespace SimpleWeb {
         
         void stop() {
             asio_io_service.stop();
+            for(auto& io_service: connection_io_services)
+                io_service->stop();
         }
         
-        //fin_rsv_opcode: 129=one fragment, text, 130=one fragment, binary, 136=close connection
-        //See http://tools.ietf.org/html/rfc6455#section-5.2 for more information
-        void send(std::shared_ptr<Connection> connection, std::ostream& stream, 
-                const std::function<void(const boost::system::error_code&)>& callback=nullptr, 
-                unsigned char fin_rsv_opcode=129) {
-            if(fin_rsv_opcode!=136)
-                timer_idle_reset(connection);
-            std::shared_ptr<boost::asio::streambuf> write_buffer(new boost::asio::streambuf);
-            std::ostream response(write_buffer.get());
-            
-            stream.seekp(0, std::ios::end);
-            size_t length=stream.tellp();
-            stream.seekp(0, std::ios::beg);
-            
-            response.put(fin_rsv_opcode);
+        //Write the header of an unmasked frame with a payload of the given length, returns the header length (2-10)
+        static size_t make_header(unsigned char* header, size_t length, unsigned char fin_rsv_opcode=129) {
+            size_t header_length=0;
+            header[header_length++]=fin_rsv_opcode;
             //unmasked (first length byte<128)
             if(length>=126) {
                 int num_bytes;
                 if(length>0xffff) {
                     num_bytes=8;
-                    response.put(127);
+                    header[header_length++]=127;
                 }
                 else {
                     num_bytes=2;
-                    response.put(126);
+                    header[header_length++]=126;
                 }
                 
                 for(int c=num_bytes-1;c>=0;c--) {
-                    response.put((length>>(8*c))%256);
+                    header[header_length++]=(length>>(8*c))%256;
                 }
             }
             else
-                response.put(length);
+                header[header_length++]=length;
             
-            response << stream.rdbuf();
+            return header_length;
+        }
+        
+        //Unmask a client payload, in and out may point to the same buffer
+        static void unmask(const unsigned char* in, unsigned char* out, size_t length, const unsigned char* mask) {
+            size_t c=0;
+            uint32_t mask32;
+            std::memcpy(&mask32, mask, 4);
+#if defined(__SSE2__)
+            __m128i mask128=_mm_set1_epi32(mask32);
+            for(;c+16<=length;c+=16) {
+                __m128i data=_mm_loadu_si128(reinterpret_cast<const __m128i*>(in+c));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out+c), _mm_xor_si128(data, mask128));
+            }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+            uint8x16_t mask128=vreinterpretq_u8_u32(vdupq_n_u32(mask32));
+            for(;c+16<=length;c+=16) {
+                vst1q_u8(out+c, veorq_u8(vld1q_u8(in+c), mask128));
+            }
+#endif
+            //c is a multiple of 4 here, so the mask lines up with the words
+            uint64_t mask64=(static_cast<uint64_t>(mask32)<<32)|mask32;
+            for(;c+8<=length;c+=8) {
+                uint64_t data;
+                std::memcpy(&data, in+c, 8);
+                data^=mask64;
+                std::memcpy(out+c, &data, 8);
+            }
+            for(;c<length;c++) {
+                out[c]=in[c]^mask[c%4];
+            }
+        }
+        
+        //fin_rsv_opcode: 129=one fragment, text, 130=one fragment, binary, 136=close connection
+        //See http://tools.ietf.org/html/rfc6455#section-5.2 for more information
+        //The payload is not copied, the same payload can be sent to several connections. On a connection with
+        //permessage-deflate a text or binary payload of at least deflate_options.min_length bytes is sent compressed.
+        //Thread safe, the write itself is started on the thread of the connection.
+        void send(std::shared_ptr<Connection> connection, std::shared_ptr<const std::string> payload, 
+                const std::function<void(const boost::system::error_code&)>& callback=nullptr, 
+                unsigned char fin_rsv_opcode=129) {
+            size_t queued=++connection->send_queue;
+            size_t queued_max=connection->send_queue_max.load();
+            while(queued>queued_max && !connection->send_queue_max.compare_exchange_weak(queued_max, queued)) {}
             
-            //Need to copy the callback-function in case its destroyed
-            boost::asio::async_write(*connection->socket, *write_buffer, 
-                    [this, connection, write_buffer, callback]
-                    (const boost::system::error_code& ec, size_t bytes_transferred) {
-                if(callback) {
-                    callback(ec);
+            std::lock_guard<std::mutex> lock(connection->send_mutex);
+            //Compress in queue order, the receiver decompresses with the same context
+            if(connection->compressor && (fin_rsv_opcode&0x0f)<8 && payload->size()>=deflate_options.min_length) {
+                auto compressed=std::make_shared<std::string>();
+                if(connection->compressor->compress(payload->data(), payload->size(), *compressed)) {
+                    deflate_bytes_in+=payload->size();
+                    deflate_bytes_out+=compressed->size();
+                    payload=std::move(compressed);
+                    //RSV1: compressed message
+                    fin_rsv_opcode|=0x40;
                 }
-            });
+                else {
+                    //Nothing of this message went out yet, continue uncompressed
+                    connection->compressor.reset();
+                }
+            }
+            connection->send_frames.emplace_back();
+            auto& frame=connection->send_frames.back();
+            frame.header_length=make_header(frame.header, payload->size(), fin_rsv_opcode);
+            frame.payload=std::move(payload);
+            //Need to copy the callback-function in case its destroyed
+            frame.callback=callback;
+            //Frames sent while a write is running or waiting to be started go out together with the next write
+            if(connection->send_writing==0 && !connection->send_posted) {
+                connection->send_posted=true;
+                //Control frames like pings do not count as activity
+                bool reset_idle=(fin_rsv_opcode&0x0f)<8;
+                connection->io_service.post([this, connection, reset_idle]() {
+                    if(reset_idle && !connection->closed.load())
+                        timer_idle_reset(connection);
+                    std::lock_guard<std::mutex> lock(connection->send_mutex);
+                    connection->send_posted=false;
+                    if(connection->send_writing==0 && !connection->send_frames.empty())
+                        write_frames(connection);
+                });
+            }
+        }
+        
+        void send(std::shared_ptr<Connection> connection, std::ostream& stream, 
+                const std::function<void(const boost::system::error_code&)>& callback=nullptr, 
+                unsigned char fin_rsv_opcode=129) {
+            auto payload=std::make_shared<std::string>(std::istreambuf_iterator<char>(stream.rdbuf()),
+                    std::istreambuf_iterator<char>());
+            send(connection, std::shared_ptr<const std::string>(std::move(payload)), callback, fin_rsv_opcode);
         }
         
         void send_close(std::shared_ptr<Connection> connection, int status, const std::string& reason="") {
@@ -181,7 +387,11 @@ namespace SimpleWeb {
         std::set<std::shared_ptr<Connection> > connections;
         std::mutex connections_mutex;
         
+        //One io_service per thread. A connection stays on the io_service it was accepted for, so its handlers never
+        //run concurrently and need no strand, while the connections spread over all cores.
         boost::asio::io_service asio_io_service;
+        std::vector<std::unique_ptr<boost::asio::io_service> > connection_io_services;
+        std::atomic<size_t> next_io_service;
         boost::asio::ip::tcp::endpoint asio_endpoint;
         boost::asio::ip::tcp::acceptor asio_acceptor;
         size_t num_threads;
@@ -190,14 +400,64 @@ namespace SimpleWeb {
         size_t timeout_request;
         size_t timeout_idle;
         
+        //num_threads=0: one thread per core
         SocketServerBase(unsigned short port, size_t num_threads, size_t timeout_request, size_t timeout_idle) : 
-                asio_endpoint(boost::asio::ip::tcp::v4(), port), asio_acceptor(asio_io_service, asio_endpoint), num_threads(num_threads),
-                timeout_request(timeout_request), timeout_idle(timeout_idle) {}
+                messages_sent(0), bytes_sent(0), deflate_bytes_in(0), deflate_bytes_out(0), connections_evicted(0), next_io_service(0), asio_endpoint(boost::asio::ip::tcp::v4(), port), asio_acceptor(asio_io_service, asio_endpoint), num_threads(num_threads),
+                timeout_request(timeout_request), timeout_idle(timeout_idle) {
+            if(this->num_threads==0)
+                this->num_threads=std::max(1u, std::thread::hardware_concurrency());
+            for(size_t c=1;c<this->num_threads;c++)
+                connection_io_services.emplace_back(new boost::asio::io_service(1));
+        }
+        
+        //Round robin over the io_services for new connections
+        boost::asio::io_service& connection_io_service() {
+            size_t c=next_io_service++%num_threads;
+            return c==0?asio_io_service:*connection_io_services[c-1];
+        }
         
         virtual void accept()=0;
         
+        //Write all queued frames of a connection with one gather write (writev), send_mutex has to be locked
+        void write_frames(const std::shared_ptr<Connection>& connection) {
+            std::vector<boost::asio::const_buffer> buffers;
+            buffers.reserve(connection->send_frames.size()*2);
+            for(auto& frame: connection->send_frames) {
+                buffers.emplace_back(frame.header, frame.header_length);
+                if(!frame.payload->empty())
+                    buffers.emplace_back(frame.payload->data(), frame.payload->size());
+            }
+            connection->send_writing=connection->send_frames.size();
+            
+            boost::asio::async_write(*connection->socket, buffers, 
+                    [this, connection](const boost::system::error_code& ec, size_t bytes_transferred) {
+                std::vector<std::function<void(const boost::system::error_code&)> > callbacks;
+                {
+                    std::lock_guard<std::mutex> lock(connection->send_mutex);
+                    //After an error the socket is unusable, drop the waiting frames as well
+                    size_t frames=ec?connection->send_frames.size():connection->send_writing;
+                    for(size_t c=0;c<frames;c++) {
+                        if(connection->send_frames.front().callback)
+                            callbacks.emplace_back(std::move(connection->send_frames.front().callback));
+                        connection->send_frames.pop_front();
+                    }
+                    connection->send_queue-=frames;
+                    connection->send_writing=0;
+                    if(!ec) {
+                        messages_sent+=frames;
+                        bytes_sent+=bytes_transferred;
+                        if(!connection->send_frames.empty())
+                            write_frames(connection);
+                    }
+                }
+                for(auto& callback: callbacks) {
+                    callback(ec);
+                }
+            });
+        }
+        
         std::shared_ptr<boost::asio::deadline_timer> set_timeout_on_connection(std::shared_ptr<Connection> connection, size_t seconds) {
-            std::shared_ptr<boost::asio::deadline_timer> timer(new boost::asio::deadline_timer(asio_io_service));
+            std::shared_ptr<boost::asio::deadline_timer> timer(new boost::asio::deadline_timer(connection->io_service));
             timer->expires_from_now(boost::posix_time::seconds(seconds));
             timer->async_wait([connection](const boost::system::error_code& ec){
                 if(!ec) {
@@ -208,12 +468,16 @@ namespace SimpleWeb {
             return timer;
         }
 
-        void read_handshake(std::shared_ptr<Connection> connection) {
-            connection->read_remote_endpoint_data();
-            
-            //Create new read_buffer for async_read_until()
-            //Shared_ptr is used to pass temporary objects to the asynchronous functions
-            std::shared_ptr<boost::asio::streambuf> read_buffer(new boost::asio::streambuf);
+        //read_buffer is set for the next request on a kept alive connection, it may hold a pipelined request
+        void read_handshake(std::shared_ptr<Connection> connection, 
+                std::shared_ptr<boost::asio::streambuf> read_buffer=nullptr) {
+            if(!read_buffer) {
+                connection->read_remote_endpoint_data();
+                
+                //Create new read_buffer for async_read_until()
+                //Shared_ptr is used to pass temporary objects to the asynchronous functions
+                read_buffer=std::make_shared<boost::asio::streambuf>();
+            }
 
             //Set timeout on the following boost::asio::async-read or write function
             std::shared_ptr<boost::asio::deadline_timer> timer;
@@ -240,6 +504,8 @@ namespace SimpleWeb {
             std::regex e("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
 
             std::smatch sm;
+            
+            connection->header.clear();
 
             //First parse request method, path, and HTTP-version from the first line
             std::string line;
@@ -266,6 +532,11 @@ namespace SimpleWeb {
         }
         
         void write_handshake(std::shared_ptr<Connection> connection, std::shared_ptr<boost::asio::streambuf> read_buffer) {
+            if(connection->header.count("Sec-WebSocket-Key")==0) {
+                write_resource(connection, read_buffer);
+                return;
+            }
+            
             //Find path- and method-match, and generate response
             for(auto& an_endpoint: endpoint) {
                 std::regex e(an_endpoint.first);
@@ -293,6 +564,108 @@ namespace SimpleWeb {
             }
         }
         
+        void write_resource(std::shared_ptr<Connection> connection, std::shared_ptr<boost::asio::streambuf> read_buffer) {
+            std::shared_ptr<Response> response(new Response());
+            
+            //a keep-alive request replaces the path the match of the previous one points into
+            connection->path_match=std::smatch();
+            connection->resource_path=connection->path.substr(0, connection->path.find('?'));
+            const std::string& path=connection->resource_path;
+            bool found=false;
+            if(connection->method=="GET") {
+                auto it=path_resource.find(path);
+                if(it!=path_resource.end()) {
+                    it->second(connection, *response);
+                    found=true;
+                }
+                for(auto& a_resource: resource) {
+                    if(found)
+                        break;
+                    std::regex e(a_resource.first);
+                    std::smatch path_match;
+                    if(std::regex_match(path, path_match, e)) {
+                        connection->path_match=std::move(path_match);
+                        a_resource.second(connection, *response);
+                        found=true;
+                    }
+                }
+            }
+            if(!found) {
+                *response << "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            }
+            
+            std::vector<boost::asio::const_buffer> buffers;
+            buffers.emplace_back(response->buffer.data());
+            if(response->content && response->content_length>0)
+                buffers.emplace_back(response->content->data()+response->content_offset, response->content_length);
+            boost::asio::async_write(*connection->socket, buffers, 
+                    [this, connection, read_buffer, response](const boost::system::error_code& ec, size_t bytes_transferred) {
+                if(!ec && response->file_length>0) {
+                    send_file(connection, response, [this, connection, read_buffer, response](const boost::system::error_code& ec) {
+                        resource_done(connection, read_buffer, response, ec);
+                    });
+                }
+                else
+                    resource_done(connection, read_buffer, response, ec);
+            });
+        }
+        
+        //Write the file part of a response, the socket is switched to non-blocking and sendfile is retried whenever
+        //the socket is writable again
+        void send_file(std::shared_ptr<Connection> connection, std::shared_ptr<Response> response, 
+                const std::function<void(const boost::system::error_code&)>& callback) {
+            auto& socket=connection->socket->lowest_layer();
+            boost::system::error_code ec;
+            socket.native_non_blocking(true, ec);
+            while(!ec && response->file_length>0) {
+#ifdef __linux__
+                off_t offset=response->file_offset;
+                ssize_t n=::sendfile(socket.native_handle(), response->file_fd, &offset, response->file_length);
+#else
+                char chunk[65536];
+                ssize_t n=::pread(response->file_fd, chunk, std::min(sizeof(chunk), response->file_length), 
+                        response->file_offset);
+                if(n>0)
+                    n=::write(socket.native_handle(), chunk, n);
+#endif
+                if(n>0) {
+                    response->file_offset+=n;
+                    response->file_length-=n;
+                }
+                else if(n<0 && errno==EINTR)
+                    continue;
+                else if(n<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) {
+                    socket.async_wait(boost::asio::ip::tcp::socket::wait_write, 
+                            [this, connection, response, callback](const boost::system::error_code& ec) {
+                        if(ec)
+                            callback(ec);
+                        else
+                            send_file(connection, response, callback);
+                    });
+                    return;
+                }
+                else {
+                    //n==0: the file got shorter than announced
+                    ec=boost::system::error_code(n<0?errno:EIO, boost::system::system_category());
+                }
+            }
+            callback(ec);
+        }
+        
+        void resource_done(std::shared_ptr<Connection> connection, std::shared_ptr<boost::asio::streambuf> read_buffer, 
+                std::shared_ptr<Response> response, const boost::system::error_code& ec) {
+            //Persistent connections are the default since HTTP/1.1
+            auto it=connection->header.find("Connection");
+            if(!ec && response->keep_alive && connection->http_version=="1.1" && 
+                    (it==connection->header.end() || it->second.find("close")==std::string::npos)) {
+                read_handshake(connection, read_buffer);
+                return;
+            }
+            boost::system::error_code ec_ignored;
+            connection->socket->lowest_layer().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec_ignored);
+            connection->socket->lowest_layer().close(ec_ignored);
+        }
+        
         bool generate_handshake(std::shared_ptr<Connection> connection, std::ostream& handshake) const {
             if(connection->header.count("Sec-WebSocket-Key")==0)
                 return 0;
@@ -303,6 +676,14 @@ namespace SimpleWeb {
             handshake << "Upgrade: websocket\r\n";
             handshake << "Connection: Upgrade\r\n";
             handshake << "Sec-WebSocket-Accept: " << Crypto::Base64::encode(sha1) << "\r\n";
+            auto extensions=connection->header.find("Sec-WebSocket-Extensions");
+            Deflate::Params params;
+            if(deflate_options.enabled && extensions!=connection->header.end() && 
+                    Deflate::negotiate(extensions->second, deflate_options, params)) {
+                connection->compressor=std::unique_ptr<Deflate::Compressor>(new Deflate::Compressor(deflate_options, params));
+                connection->deflate=true;
+                handshake << "Sec-WebSocket-Extensions: " << Deflate::response(params) << "\r\n";
+            }
             handshake << "\r\n";
             
             return 1;
@@ -393,20 +774,47 @@ namespace SimpleWeb {
                     [this, connection, read_buffer, length, &callbacks, fin_rsv_opcode]
                     (const boost::system::error_code& ec, size_t bytes_transferred) {
                 if(!ec) {
-                    std::istream raw_message_data(read_buffer.get());
-
-                    //Read mask
-                    std::vector<unsigned char> mask;
-                    mask.resize(4);
-                    raw_message_data.read((char*)&mask[0], 4);
+                    //The mask and the payload are contiguous in the read buffer, unmask them straight into the
+                    //message buffer
+                    const unsigned char* raw_message_data=boost::asio::buffer_cast<const unsigned char*>(read_buffer->data());
+                    
+                    //Any frame shows that the client is alive
+                    connection->pong_pending=false;
                     
                     std::shared_ptr<Message> message(new Message());
                     message->length=length;
                     message->fin_rsv_opcode=fin_rsv_opcode;
                     
-                    std::ostream message_data_out_stream(&message->data_buffer);
-                    for(size_t c=0;c<length;c++) {
-                        message_data_out_stream.put(raw_message_data.get()^mask[c%4]);
+                    //RSV1: compressed message, only allowed on data frames after permessage-deflate was negotiated
+                    if(fin_rsv_opcode&0x40) {
+                        if(!connection->deflate || (fin_rsv_opcode&0x0f)>=8) {
+                            const std::string reason="unexpected compressed frame";
+                            send_close(connection, 1002, reason);
+                            connection_close(connection, callbacks, 1002, reason);
+                            return;
+                        }
+                        if(!connection->decompressor)
+                            connection->decompressor=std::unique_ptr<Deflate::Decompressor>(new Deflate::Decompressor());
+                        auto& decompressor=*connection->decompressor;
+                        decompressor.input.resize(length);
+                        unmask(raw_message_data+4, decompressor.input.data(), length, raw_message_data);
+                        read_buffer->consume(4+length);
+                        if(!decompressor.decompress(length, message->data_buffer, deflate_options.max_message_length)) {
+                            //1009: message too big, 1007: corrupt data
+                            int status=message->data_buffer.size()>deflate_options.max_message_length?1009:1007;
+                            const std::string reason="invalid compressed message";
+                            send_close(connection, status, reason);
+                            connection_close(connection, callbacks, status, reason);
+                            return;
+                        }
+                        message->length=message->data_buffer.size();
+                        message->fin_rsv_opcode=fin_rsv_opcode&0xbf;
+                    }
+                    else {
+                        unsigned char* message_data=boost::asio::buffer_cast<unsigned char*>(message->data_buffer.prepare(length));
+                        unmask(raw_message_data+4, message_data, length, raw_message_data);
+                        message->data_buffer.commit(length);
+                        read_buffer->consume(4+length);
                     }
                     
                     //If connection close
@@ -428,9 +836,12 @@ namespace SimpleWeb {
                     }
                     //If ping
                     else if((fin_rsv_opcode&0x0f)==9) {
-                        //send pong
-                        std::stringstream empty_ss;
-                        send(connection, empty_ss, nullptr, fin_rsv_opcode+1);
+                        //send pong with the payload of the ping
+                        send(connection, std::make_shared<const std::string>(message->begin(), message->end()), 
+                                nullptr, 138);
+                    }
+                    //If pong, already handled above
+                    else if((fin_rsv_opcode&0x0f)==10) {
                     }
                     else if(callbacks.onmessage) {
                         timer_idle_reset(connection);
@@ -447,6 +858,7 @@ namespace SimpleWeb {
         
         void connection_open(std::shared_ptr<Connection> connection, const Callbacks& callbacks) {
             timer_idle_init(connection);
+            timer_ping_init(connection);
             connections_mutex.lock();
             connections.insert(connection);
             connections_mutex.unlock();
@@ -456,6 +868,7 @@ namespace SimpleWeb {
         
         void connection_close(std::shared_ptr<Connection> connection, const Callbacks& callbacks, int status, const std::string& reason) {
             timer_idle_cancel(connection);
+            timer_ping_cancel(connection);
             connections_mutex.lock();
             connections.erase(connection);
             connections_mutex.unlock();
@@ -465,6 +878,7 @@ namespace SimpleWeb {
         
         void connection_error(std::shared_ptr<Connection> connection, const Callbacks& callbacks, const boost::system::error_code& ec) {
             timer_idle_cancel(connection);
+            timer_ping_cancel(connection);
             connections_mutex.lock();
             connections.erase(connection);
             connections_mutex.unlock();
@@ -476,7 +890,7 @@ namespace SimpleWeb {
         
         void timer_idle_init(std::shared_ptr<Connection> connection) {
             if(timeout_idle>0) {
-                connection->timer_idle=std::unique_ptr<boost::asio::deadline_timer>(new boost::asio::deadline_timer(asio_io_service));
+                connection->timer_idle=std::unique_ptr<boost::asio::deadline_timer>(new boost::asio::deadline_timer(connection->io_service));
                 connection->timer_idle->expires_from_now(boost::posix_time::seconds(timeout_idle));
                 timer_idle_expired_function(connection);
             }
@@ -499,6 +913,50 @@ namespace SimpleWeb {
                 }
             });
         }
+        
+        void timer_ping_init(std::shared_ptr<Connection> connection) {
+            if(ping_interval>0) {
+                connection->timer_ping=std::unique_ptr<boost::asio::deadline_timer>(new boost::asio::deadline_timer(connection->io_service));
+                timer_ping_wait(connection, ping_interval, false);
+            }
+        }
+        void timer_ping_cancel(std::shared_ptr<Connection> connection) {
+            if(ping_interval>0)
+                connection->timer_ping->cancel();
+        }
+        
+        //Alternates between sending a ping and checking for the answer after pong_timeout
+        void timer_ping_wait(std::shared_ptr<Connection> connection, size_t seconds, bool check) {
+            connection->timer_ping->expires_from_now(boost::posix_time::seconds(seconds));
+            connection->timer_ping->async_wait([this, connection, check](const boost::system::error_code& ec){
+                if(ec)
+                    return;
+                size_t timeout=pong_timeout>0 && pong_timeout<ping_interval?pong_timeout:ping_interval;
+                //A close handshake that is not finished by now will not be finished
+                if(connection->closed.load() || (check && connection->pong_pending)) {
+                    evict(connection);
+                }
+                else if(check) {
+                    timer_ping_wait(connection, ping_interval-timeout, false);
+                }
+                else {
+                    connection->pong_pending=true;
+                    static const auto empty=std::make_shared<const std::string>();
+                    //fin_rsv_opcode=137: ping
+                    send(connection, empty, nullptr, 137);
+                    timer_ping_wait(connection, timeout, true);
+                }
+            });
+        }
+        
+        //Close the socket of a connection that does not answer, the pending read fails and ends the connection
+        void evict(std::shared_ptr<Connection> connection) {
+            connections_evicted++;
+            connection->closed.store(true);
+            boost::system::error_code ec_ignored;
+            connection->socket->lowest_layer().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec_ignored);
+            connection->socket->lowest_layer().close(ec_ignored);
+        }
     };
     
     template<class socket_type>
@@ -516,7 +974,8 @@ namespace SimpleWeb {
         void accept() {
             //Create new socket for this connection (stored in Connection::socket)
             //Shared_ptr is used to pass temporary objects to the asynchronous functions
-            std::shared_ptr<Connection> connection(new Connection(new WS(asio_io_service)));
+            auto& io_service=connection_io_service();
+            std::shared_ptr<Connection> connection(new Connection(io_service, new WS(io_service)));
             
             asio_acceptor.async_accept(*connection->socket, [this, connection](const boost::system::error_code& ec) {
                 //Immediately start accepting a new connection
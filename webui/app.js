@@ -26,12 +26,12 @@ var game = {
     laps_init: false,
     positions: [],
     cars: [
-        { id: 0, laps: 0, last_time: 0, best_time: 0 },
-        { id: 1, laps: 0, last_time: 0, best_time: 0 },
-        { id: 2, laps: 0, last_time: 0, best_time: 0 },
-        { id: 3, laps: 0, last_time: 0, best_time: 0 },
-        { id: 4, laps: 0, last_time: 0, best_time: 0 },
-        { id: 5, laps: 0, last_time: 0, best_time: 0 },
+        { id: 0, laps: 0, last_time: 0, best_time: 0, reaction_time: 0, jump_start: false },
+        { id: 1, laps: 0, last_time: 0, best_time: 0, reaction_time: 0, jump_start: false },
+        { id: 2, laps: 0, last_time: 0, best_time: 0, reaction_time: 0, jump_start: false },
+        { id: 3, laps: 0, last_time: 0, best_time: 0, reaction_time: 0, jump_start: false },
+        { id: 4, laps: 0, last_time: 0, best_time: 0, reaction_time: 0, jump_start: false },
+        { id: 5, laps: 0, last_time: 0, best_time: 0, reaction_time: 0, jump_start: false },
     ],
     controllers: [
         { id: 0, driver: 0, connected: false, image: 'images/driver_green.png' },
@@ -42,9 +42,11 @@ var game = {
         { id: 5, driver: 0, connected: false, image: 'images/driver_blue.png' },
     ],
     drivers: [
-        { id: 0, name: "Unbekannt", power: 100, image: 'images/driver.png' },
+        { id: 0, name: "Unbekannt", power: 100, curve: 'linear', image: 'images/driver.png' },
     ],
     bind_car_id: 6,
+    ghost_lane: -1,
+    ghost_lap_time: 0,
     digital_car_mode: true
 };
 
@@ -66,6 +68,10 @@ app.factory('backend', ['$rootScope', '$timeout', function($rootScope, $timeout)
             break;
         case "COUNTDOWN":
             state = "Achtung";
+            game.cars.forEach(function(car) {
+                car.reaction_time = 0;
+                car.jump_start = false;
+            });
             break;
         case "BINDING":
             state = "Programmierung";
@@ -116,6 +122,11 @@ app.factory('backend', ['$rootScope', '$timeout', function($rootScope, $timeout)
         $timeout(function() {$rootScope.$apply(game.show_false_start = false);}, 5000);
     }
 
+    function on_reaction(obj) {
+        $rootScope.$apply(game.cars[obj.id].reaction_time = obj.reaction_time);
+        $rootScope.$apply(game.cars[obj.id].jump_start = obj.jump_start);
+    }
+
     function on_laps_update(obj) {
         if (game.laps_init) {
             $rootScope.$apply(game.show_laps_update = true);
@@ -157,6 +168,11 @@ app.factory('backend', ['$rootScope', '$timeout', function($rootScope, $timeout)
         $rootScope.$apply(game.controllers[obj.id].connected = obj.connected);
     }
 
+    function on_ghost(obj) {
+        $rootScope.$apply(game.ghost_lane = obj.lane);
+        $rootScope.$apply(game.ghost_lap_time = obj.lap_time);
+    }
+
     backend.connect = function() {
         $rootScope.connect();
     };
@@ -166,7 +182,9 @@ app.factory('backend', ['$rootScope', '$timeout', function($rootScope, $timeout)
     };
 
     $rootScope.connect = function() {
-        var url = "ws://localhost:8383/sclx";
+        // served by sclx itself or opened as a local file
+        var host = location.protocol === "http:" ? location.host : "localhost:8383";
+        var url = "ws://" + host + "/sclx";
         ws = new WebSocket(url);
         ws.onclose = function(){
             $rootScope.$apply(game.state = "Verbindungsfehler");
@@ -174,38 +192,56 @@ app.factory('backend', ['$rootScope', '$timeout', function($rootScope, $timeout)
         };
         ws.onmessage = function(msg){
             var obj = JSON.parse(msg.data);
-            switch (obj.type) {
-            case "game_state":
-                on_game_state(obj);
-                break;
-            case "game_update":
-                on_game_update(obj);
-                break;
-            case "game_finished":
-                on_game_finished(obj);
-                break;
-            case "lap_count":
-                on_lap_count(obj);
-                break;
-            case "false_start":
-                on_false_start(obj);
-                break;
-            case "laps_update":
-                on_laps_update(obj);
-                break;
-            case "countdown":
-                on_countdown(obj);
-                break;
-            case "settings":
-                on_settings(obj);
-                break;
-            case "controller_changed":
-                on_controller_changed(obj);
-                break;
+            // events of one powerbase cycle arrive as an array
+            if (Array.isArray(obj)) {
+                obj.forEach(on_message);
+            } else {
+                on_message(obj);
             }
         };
     }
 
+    function on_message(obj) {
+        switch (obj.type) {
+        case "game_state":
+            on_game_state(obj);
+            break;
+        case "game_update":
+            on_game_update(obj);
+            break;
+        case "game_finished":
+            on_game_finished(obj);
+            break;
+        case "lap_count":
+            on_lap_count(obj);
+            break;
+        case "false_start":
+            on_false_start(obj);
+            break;
+        case "reaction":
+            on_reaction(obj);
+            break;
+        case "laps_update":
+            on_laps_update(obj);
+            break;
+        case "countdown":
+            on_countdown(obj);
+            break;
+        case "settings":
+            on_settings(obj);
+            break;
+        case "controller_changed":
+            on_controller_changed(obj);
+            break;
+        case "ghost":
+            on_ghost(obj);
+            break;
+        case "error":
+            console.warn("sclx rejected " + obj.command + ": " + obj.message);
+            break;
+        }
+    }
+
     return backend;
 }]);
 
@@ -276,7 +312,7 @@ app.controller('sclx_ctrl', ['$rootScope', 'backend', 'ngAudio', function($rootS
                 next_id++;
             }
         }
-        this.game.drivers.push({ id: next_id, name: "", power: 100, image: 'images/driver.png' });
+        this.game.drivers.push({ id: next_id, name: "", power: 100, curve: 'linear', image: 'images/driver.png' });
     };
     this.delete_driver = function(id) {
         for (i in this.game.drivers) {
@@ -286,6 +322,13 @@ app.controller('sclx_ctrl', ['$rootScope', 'backend', 'ngAudio', function($rootS
             }
         }
     };
+    // the ghost car replays the fastest lap on a lane without a handset
+    this.toggle_ghost = function(id) {
+        backend.send({
+            type: "ghost",
+            lane: this.game.ghost_lane == id ? -1 : id
+        });
+    };
     this.bind_car = function(id) {
         this.game.bind_car_id = id;
         backend.send({
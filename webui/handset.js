@@ -0,0 +1,129 @@
+// A phone as handset for a lane without a physical one. The state goes to sclx as a small binary frame on every
+// change and every 20ms, sclx brakes the car when the frames stop.
+(function() {
+    var SEND_INTERVAL = 20;  // ms
+    var ACK_EVERY = 25;      // frames, the acknowledgements give the round trip
+    var FLAG_BRAKE = 1;
+    var FLAG_LANE_CHANGE = 2;
+    var FLAG_ACK = 128;
+    var ACK_REJECTED = 1;
+
+    var state = { lane: 0, power: 0, brake: false, lane_change: false };
+    var ws = null;
+    var frames = 0;
+    var frame = new ArrayBuffer(8);
+    var view = new DataView(frame);
+
+    function el(id) {
+        return document.getElementById(id);
+    }
+
+    function status(text) {
+        el("status").textContent = text;
+    }
+
+    // 0.1ms resolution, wraps after 5 days
+    function stamp() {
+        return Math.round(performance.now() * 10) >>> 0;
+    }
+
+    function connect() {
+        // served by sclx itself or opened as a local file
+        var host = location.protocol === "http:" ? location.host : "localhost:8383";
+        ws = new WebSocket("ws://" + host + "/sclx");
+        ws.binaryType = "arraybuffer";
+        ws.onopen = function() {
+            // no race events, only the acknowledgements
+            ws.send(JSON.stringify({ type: "subscribe", topics: [] }));
+            status("Verbunden");
+        };
+        ws.onclose = function() {
+            status("Verbindungsfehler");
+            setTimeout(connect, 1000);
+        };
+        ws.onmessage = function(msg) {
+            if (!(msg.data instanceof ArrayBuffer) || msg.data.byteLength !== 8) {
+                return;
+            }
+            var ack = new DataView(msg.data);
+            if (ack.getUint8(0) !== 65) { // 'A'
+                return;
+            }
+            var rtt = ((stamp() - ack.getUint32(4, true)) >>> 0) / 10;
+            el("rtt").textContent = rtt.toFixed(1) + " ms";
+            status(ack.getUint8(2) & ACK_REJECTED ? "Spur belegt" : "Verbunden");
+        };
+    }
+
+    function send() {
+        // a hidden page sends nothing, so the car stops
+        if (!ws || ws.readyState !== WebSocket.OPEN || document.hidden) {
+            return;
+        }
+        var flags = (state.brake ? FLAG_BRAKE : 0) | (state.lane_change ? FLAG_LANE_CHANGE : 0);
+        if (++frames % ACK_EVERY === 0) {
+            flags |= FLAG_ACK;
+        }
+        view.setUint8(0, 72); // 'H'
+        view.setUint8(1, state.lane);
+        view.setUint8(2, state.power);
+        view.setUint8(3, flags);
+        view.setUint32(4, stamp(), true);
+        ws.send(frame);
+    }
+
+    function set_power(power) {
+        state.power = Math.max(0, Math.min(63, power));
+        el("throttle_bar").style.height = (state.power * 100 / 63) + "%";
+        el("power").textContent = state.power;
+        send();
+    }
+
+    function hold(id, key) {
+        var button = el(id);
+        var set = function(value) {
+            return function(e) {
+                e.preventDefault();
+                if (state[key] !== value) {
+                    state[key] = value;
+                    send();
+                }
+            };
+        };
+        button.addEventListener("pointerdown", set(true));
+        button.addEventListener("pointerup", set(false));
+        button.addEventListener("pointercancel", set(false));
+        button.addEventListener("pointerleave", set(false));
+    }
+
+    window.addEventListener("load", function() {
+        var throttle = el("throttle");
+        var move = function(e) {
+            var rect = throttle.getBoundingClientRect();
+            set_power(Math.round((rect.bottom - e.clientY) / rect.height * 63));
+        };
+        throttle.addEventListener("pointerdown", function(e) {
+            throttle.setPointerCapture(e.pointerId);
+            move(e);
+        });
+        throttle.addEventListener("pointermove", function(e) {
+            if (e.buttons || e.pointerType === "touch") {
+                move(e);
+            }
+        });
+        throttle.addEventListener("pointerup", function() { set_power(0); });
+        throttle.addEventListener("pointercancel", function() { set_power(0); });
+        hold("brake", "brake");
+        hold("lane_change", "lane_change");
+        // the lane belongs to the connection, a new one releases the old lane
+        el("lane").addEventListener("change", function() {
+            state.lane = parseInt(el("lane").value, 10);
+            set_power(0);
+            if (ws) {
+                ws.close();
+            }
+        });
+        setInterval(send, SEND_INTERVAL);
+        connect();
+    });
+})();